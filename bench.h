@@ -0,0 +1,428 @@
+/* `make bench`: configuration and driver of the widget microbenchmark.
+ * Included by main.c in place of `config.h` when built with -DBENCH.
+ *
+ * Widgets read a fixture tree generated under BENCH_DIR (battery in
+ * power_supply, hwmon sensor, /proc/stat, /proc/diskstats) and the loopback interface, in a fresh
+ * network namespace when allowed to create one. Each widget is run
+ * `n` times, its sources are collected before every run as on a new tick.
+ *
+ * syscalls/call are counted at libc call sites in dwmstatus code (see
+ * BENCH_WRAP in Makefile), allocs/call are all malloc/calloc/realloc calls
+ * in the process. */
+
+#include <linux/sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#ifndef BENCH_DIR
+#define BENCH_DIR "/tmp/" NAME "-bench"
+#endif
+
+#define BENCH_NCPU 256	/* cores in the generated /proc/stat */
+#define BENCH_NDISK 512	/* devices in the generated /proc/diskstats */
+
+#define CONFIG_VERSION_MAJOR 1
+#define CONFIG_VERSION_MINOR 6
+
+#define WIDGET_BUFLEN  32
+#define STATUS_BUFLEN  256
+
+static const char *status_begin = " ";
+static const char *status_delim = " | ";
+static const char *status_end = " ";
+static const char *status_stale = "~";
+
+static const long adaptive_battery_stretch = 4;
+
+static const struct mktimes_arg barg_time_local = {
+	.fmt="%u %d%m%y %H%M%S%z", .tzname=NULL
+};
+static const struct mktimes_arg barg_time_tz = {
+	.fmt="%u %d%m%y %H%M%S%z", .tzname="Europe/Berlin"
+};
+static const struct getdiskusage_arg barg_fsavail = {
+	.path=BENCH_DIR, .name="/", .mode=1
+};
+static const struct getbattery_arg barg_power_files = {
+	.dir=BENCH_DIR "/sys/class/power_supply/BAT0",
+	.present="present",
+	.energy_max="energy_full_design",
+	.energy_now="energy_now",
+	.power_now="power_now",
+	.status="status",
+	.status_match_count = 3,
+	.status_match = (const char*[]) {
+		"Discharging\n", "Charging\n", "Full\n"
+	},
+	.status_output = (const char*[]) {
+		"-", "+", "*"
+	},
+	.status_undef = "?"
+};
+static const struct getbattery_arg barg_power_uevent = {
+	.dir=BENCH_DIR "/sys/class/power_supply/BAT0",
+	.uevent="uevent",
+	.present="present",
+	.energy_max="energy_full_design",
+	.energy_now="energy_now",
+	.power_now="power_now",
+	.status="status",
+	.status_match_count = 3,
+	.status_match = (const char*[]) {
+		"Discharging\n", "Charging\n", "Full\n"
+	},
+	.status_output = (const char*[]) {
+		"-", "+", "*"
+	},
+	.status_undef = "?"
+};
+static const struct gettemperature_arg barg_temp = {
+	.dir=BENCH_DIR "/sys/devices/platform/coretemp.0",
+	.sensor="temp1_input"
+};
+static const struct getnetwork_arg barg_network_lo = {
+	.if_name = "lo",
+	.vi_name = "L",
+	.view_rates = 1
+};
+static const struct getnetwork_arg barg_network_hist = {
+	.if_name = "lo",
+	.vi_name = "L",
+	.view_rates = 1,
+	.rates = GETNETWORK_EWMA|GETNETWORK_PCT|GETNETWORK_SPARK,
+	.spark = 16
+};
+
+static const struct src_readfile_arg barg_stat_head = {
+	.path=BENCH_DIR "/proc/stat", .buflen=256
+};
+static const struct src_readfile_arg barg_stat = {
+	.path=BENCH_DIR "/proc/stat", .buflen=BENCH_NCPU * 100
+};
+static const struct getcpu_arg barg_cpu_total = {
+	.mode=0, .name="C"
+};
+static const struct getcpu_arg barg_cpu_top = {
+	.mode=1, .name="C", .first=0, .ncpu=BENCH_NCPU, .top=4
+};
+static const struct getcpu_arg barg_cpu_bar = {
+	.mode=2, .name=NULL, .first=0, .ncpu=BENCH_NCPU
+};
+static const struct src_readfile_arg barg_diskstats = {
+	.path=BENCH_DIR "/proc/diskstats", .buflen=BENCH_NDISK * 160
+};
+/* last devices of the file */
+static const struct getdiskio_arg barg_diskio = {
+	.name="D", .devices=(const char *[]){"nvme1n1", "dm-3", NULL},
+	.show=GETDISKIO_BYTES|GETDISKIO_IOPS|GETDISKIO_AWAIT|GETDISKIO_QUEUE
+};
+/* host /proc/meminfo */
+static const struct src_readfile_arg barg_meminfo = {
+	.path="/proc/meminfo", .buflen=4096
+};
+static const struct getmemory_arg barg_memory_used = {
+	.mode=1, .name="M"
+};
+static const struct getmemory_arg barg_memory_keys = {
+	.mode=2, .name=NULL,
+	.keys=(const char*[]) {"Dirty", "SwapFree", NULL},
+	.labels=(const char*[]) {"D", "S"}
+};
+
+static const Source source[] = {
+	/* collect, ctx_size, arg */
+	{ src_rtnl, sizeof(struct src_rtnl_ctx), {0} },
+	{ src_readfile, SRC_READFILE_CTX_SIZE(256), {.v = &barg_stat_head} },
+	{ src_readfile, SRC_READFILE_CTX_SIZE(BENCH_NCPU * 100), {.v = &barg_stat} },
+	{ src_readfile, SRC_READFILE_CTX_SIZE(BENCH_NDISK * 160), {.v = &barg_diskstats} },
+	{ src_readfile, SRC_READFILE_CTX_SIZE(4096), {.v = &barg_meminfo} },
+};
+static const Widget widget[] = {
+	/* func, buflen, ctx_size, arg, src */
+	{ mktimes, 1*WIDGET_BUFLEN, sizeof(struct mktimes_ctx), {.v = &barg_time_local} },
+	{ mktimes, 1*WIDGET_BUFLEN, sizeof(struct mktimes_ctx), {.v = &barg_time_tz} },
+	{ getbattery, 1*WIDGET_BUFLEN, sizeof(struct getbattery_ctx), {.v = &barg_power_files} },
+	{ getbattery, 1*WIDGET_BUFLEN, sizeof(struct getbattery_ctx), {.v = &barg_power_uevent} },
+	{ getdiskusage, 1*WIDGET_BUFLEN, 0, {.v = &barg_fsavail} },
+	{ getnetwork, 2*WIDGET_BUFLEN, sizeof(struct getnetwork_ctx), {.v = &barg_network_lo}, (const short[]){0, -1} },
+	{ getnetwork, 4*WIDGET_BUFLEN, sizeof(struct getnetwork_ctx), {.v = &barg_network_hist}, (const short[]){0, -1} },
+	{ gettemperature, 1*WIDGET_BUFLEN, sizeof(struct gettemperature_ctx), {.v = &barg_temp} },
+	{ getcpu, 1*WIDGET_BUFLEN, GETCPU_CTX_SIZE(0), {.v = &barg_cpu_total}, (const short[]){1, -1} },
+	{ getcpu, 2*WIDGET_BUFLEN, GETCPU_CTX_SIZE(BENCH_NCPU), {.v = &barg_cpu_top}, (const short[]){2, -1} },
+	{ getcpu, 4*BENCH_NCPU, GETCPU_CTX_SIZE(BENCH_NCPU), {.v = &barg_cpu_bar}, (const short[]){2, -1} },
+	{ getmemory, 1*WIDGET_BUFLEN, 0, {.v = &barg_memory_used}, (const short[]){4, -1} },
+	{ getmemory, 1*WIDGET_BUFLEN, 0, {.v = &barg_memory_keys}, (const short[]){4, -1} },
+	{ getdiskio, 2*WIDGET_BUFLEN, sizeof(struct getdiskio_ctx), {.v = &barg_diskio}, (const short[]){3, -1} },
+};
+static const char *bench_name[COUNT(widget)] = {
+	"mktimes", "mktimes(tz)", "getbattery(files)", "getbattery(uevent)",
+	"getdiskusage", "getnetwork", "getnetwork(hist)", "gettemperature",
+	"getcpu(total)", "getcpu(top)", "getcpu(bar)",
+	"getmemory(used)", "getmemory(keys)", "getdiskio",
+};
+static const Update update[] = {
+	/* never run, the driver calls widgets itself */
+	{ UP_ONCE, {.once={0}} },
+	{ UP_ONCE, {.once={0}} },
+};
+static const short *(update_widgets[]) = {
+	(const short[]) {-1},
+	(const short[]) {-1},
+};
+
+/* counters */
+
+static unsigned long bench_syscalls,
+		     bench_allocs;
+
+#define WRAP_SYSCALL(type, name, params, args) \
+	type __real_##name params; \
+	type __wrap_##name params \
+	{ \
+		++bench_syscalls; \
+		return __real_##name args; \
+	}
+
+WRAP_SYSCALL(int, close, (int fd), (fd))
+WRAP_SYSCALL(ssize_t, read, (int fd, void *buf, size_t n), (fd, buf, n))
+WRAP_SYSCALL(ssize_t, pread, (int fd, void *buf, size_t n, off_t off), (fd, buf, n, off))
+WRAP_SYSCALL(ssize_t, recv, (int fd, void *buf, size_t n, int flags), (fd, buf, n, flags))
+WRAP_SYSCALL(ssize_t, send, (int fd, const void *buf, size_t n, int flags), (fd, buf, n, flags))
+WRAP_SYSCALL(int, socket, (int domain, int type, int proto), (domain, type, proto))
+WRAP_SYSCALL(int, stat, (const char *path, struct stat *st), (path, st))
+WRAP_SYSCALL(int, statvfs, (const char *path, struct statvfs *st), (path, st))
+WRAP_SYSCALL(DIR *, opendir, (const char *path), (path))
+
+int __real_open(const char *path, int flags, ...);
+int __wrap_open(const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode;
+
+	va_start(ap, flags);
+	mode = va_arg(ap, mode_t);
+	va_end(ap);
+	++bench_syscalls;
+	return __real_open(path, flags, mode);
+}
+
+int __real_openat(int atfd, const char *path, int flags, ...);
+int __wrap_openat(int atfd, const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode;
+
+	va_start(ap, flags);
+	mode = va_arg(ap, mode_t);
+	va_end(ap);
+	++bench_syscalls;
+	return __real_openat(atfd, path, flags, mode);
+}
+
+/* glibc allocator entry points, so allocations inside libc count too */
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+
+void *malloc(size_t size)
+{
+	++bench_allocs;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	++bench_allocs;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	++bench_allocs;
+	return __libc_realloc(ptr, size);
+}
+
+/* fixture */
+
+static int bench_file(const char *dir, const char *name, const char *content)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	if (makepath(AT_FDCWD, dir))
+		return -1;
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (0 > fd)
+		return -1;
+	write(fd, content, strlen(content));
+	close(fd);
+	return 0;
+}
+
+/* /proc/stat of BENCH_NCPU cores */
+static int bench_stat(const char *dir)
+{
+	static char stat[BENCH_NCPU * 100 + 8192];
+	size_t n = 0;
+
+	for(int i=-1; BENCH_NCPU>i; ++i) {
+		char cpu[16] = "cpu ";
+		if (0 <= i)
+			snprintf(cpu, sizeof(cpu), "cpu%d", i);
+		n += snprintf(stat + n, sizeof(stat) - n,
+		              "%s %d 1234 %d 98765432 %d 0 %d 0 0 0\n",
+		              cpu, 4567890 + i * 37, 456789 + i, 1234 + i, 2345 + i);
+	}
+	n += snprintf(stat + n, sizeof(stat) - n, "intr 123456789");
+	while (sizeof(stat) - 16 > n)
+		n += snprintf(stat + n, sizeof(stat) - n, " 0");
+	snprintf(stat + n, sizeof(stat) - n, "\nctxt 987654321\n");
+	return bench_file(dir, "stat", stat);
+}
+
+/* /proc/diskstats of BENCH_NDISK loop, nvme and dm devices */
+static int bench_diskstats(const char *dir)
+{
+	static char stat[BENCH_NDISK * 160];
+	size_t n = 0;
+
+	for(int i=0; BENCH_NDISK>i; ++i) {
+		char dev[16];
+		int major = 7;
+		if (BENCH_NDISK - 4 > i)
+			snprintf(dev, sizeof(dev), "loop%d", i);
+		else if (BENCH_NDISK - 2 > i)
+			snprintf(dev, sizeof(dev), "nvme%dn1", i - (BENCH_NDISK - 4)), major = 259;
+		else
+			snprintf(dev, sizeof(dev), "dm-%d", i - (BENCH_NDISK - 4)), major = 253;
+		n += snprintf(stat + n, sizeof(stat) - n,
+		              "%4d %7d %s %d 12 %d 345 %d 34 %d 678 0 %d %d 0 0 0 0 0 0\n",
+		              major, i, dev, 123456 + i, 9876543 + i * 8, 65432 + i,
+		              7654321 + i * 8, 4567 + i, 12345 + i);
+	}
+	return bench_file(dir, "diskstats", stat);
+}
+
+static int bench_fixture(void)
+{
+	const char *bat = BENCH_DIR "/sys/class/power_supply/BAT0";
+	const char *hwmon = BENCH_DIR "/sys/devices/platform/coretemp.0/hwmon/hwmon0";
+
+	return bench_file(bat, "present", "1\n")
+	    || bench_file(bat, "energy_full_design", "50000000\n")
+	    || bench_file(bat, "energy_now", "31000000\n")
+	    || bench_file(bat, "power_now", "7500000\n")
+	    || bench_file(bat, "status", "Discharging\n")
+	    || bench_file(bat, "uevent",
+	                  "POWER_SUPPLY_NAME=BAT0\n"
+	                  "POWER_SUPPLY_TYPE=Battery\n"
+	                  "POWER_SUPPLY_STATUS=Discharging\n"
+	                  "POWER_SUPPLY_PRESENT=1\n"
+	                  "POWER_SUPPLY_TECHNOLOGY=Li-ion\n"
+	                  "POWER_SUPPLY_CYCLE_COUNT=0\n"
+	                  "POWER_SUPPLY_VOLTAGE_MIN_DESIGN=11400000\n"
+	                  "POWER_SUPPLY_VOLTAGE_NOW=12100000\n"
+	                  "POWER_SUPPLY_POWER_NOW=7500000\n"
+	                  "POWER_SUPPLY_ENERGY_FULL_DESIGN=50000000\n"
+	                  "POWER_SUPPLY_ENERGY_FULL=45000000\n"
+	                  "POWER_SUPPLY_ENERGY_NOW=31000000\n"
+	                  "POWER_SUPPLY_CAPACITY=68\n"
+	                  "POWER_SUPPLY_CAPACITY_LEVEL=Normal\n"
+	                  "POWER_SUPPLY_MODEL_NAME=bench\n"
+	                  "POWER_SUPPLY_MANUFACTURER=bench\n"
+	                  "POWER_SUPPLY_SERIAL_NUMBER=0\n")
+	    || bench_file(hwmon, "temp1_input", "45000\n")
+	    || bench_stat(BENCH_DIR "/proc")
+	    || bench_diskstats(BENCH_DIR "/proc");
+}
+
+/* Private network namespace with only the loopback, up */
+static void bench_netns(void)
+{
+	struct ifreq ifr = {0};
+	int fd;
+
+	if (syscall(SYS_unshare, CLONE_NEWNET)) {
+		NOTE("Can't create network namespace, using host loopback. %s",
+		     strerror(errno));
+		return;
+	}
+	fd = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+	strcpy(ifr.ifr_name, "lo");
+	if (0 > fd
+	|| 0 > ioctl(fd, SIOCGIFFLAGS, &ifr)
+	|| (ifr.ifr_flags |= IFF_UP, 0 > ioctl(fd, SIOCSIFFLAGS, &ifr)))
+		NOTE("Can't bring loopback up. %s", strerror(errno));
+	if (0 <= fd)
+		close(fd);
+}
+
+/* driver */
+
+/* Fill the history of a `getnetwork` with a second per sample up to now,
+ * calls are much closer than GETNETWORK_MIN_NS and would never add one */
+static void bench_network_hist(struct getnetwork_ctx *c, const struct getnetwork_arg *s)
+{
+	const struct src_rtnl_link *link = c->link;
+	struct src_rtnl_link l = {0};
+	int64_t t = clock_ns(CLOCK_MONOTONIC) - (GETNETWORK_HIST + 1) * (int64_t)1000000000;
+
+	memset(c, 0, sizeof(*c));
+	c->link = link;
+	/* the first one only sets the base */
+	for(int i=0; GETNETWORK_HIST>=i; ++i) {
+		l.rx += 1000 + i * 7919 % 100000;
+		l.tx += 100 + i * 104729 % 20000;
+		getnetwork_sample(c, &l, t + i * (int64_t)1000000000,
+		                  s->ewma ? s->ewma : GETNETWORK_EWMA_MS);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long n = 1 < argc ? strtoul(argv[1], NULL, 10) : 1000000;
+
+	if (0 == n || bench_fixture()) {
+		ERROR("usage: %s [iterations], fixture at " BENCH_DIR, argv[0]);
+		return ERR_INVALID_INPUT;
+	}
+	bench_netns();
+	setup();
+
+	printf("%-20s %12s %14s %12s  %.40s\n",
+	       "widget", "ns/call", "syscalls/call", "allocs/call", "output");
+	for(short w=0; COUNT(widget)>w; ++w) {
+		const Widget *wd = &widget[w];
+		ssize_t rc = 0;
+
+		/* warm up: open files, sockets, caches */
+		for(int i=0; 2>i; ++i) {
+			++tick;
+			collect_sources(w);
+			cur_widget = w;
+			(wd->func)(widget_tmp, wd->buflen, widget_ctx[w], wd->arg);
+		}
+		if (getnetwork == wd->func)
+			bench_network_hist(widget_ctx[w], wd->arg.v);
+
+		unsigned long syscalls = bench_syscalls,
+			      allocs = bench_allocs;
+		int64_t t = clock_ns(CLOCK_MONOTONIC);
+		for(unsigned long i=0; n>i; ++i) {
+			++tick;
+			collect_sources(w);
+			cur_widget = w;
+			rc |= (wd->func)(widget_tmp, wd->buflen, widget_ctx[w], wd->arg);
+		}
+		t = clock_ns(CLOCK_MONOTONIC) - t;
+		cur_widget = -1;
+
+		printf("%-20s %12.1f %14.2f %12.2f  %.40s%s\n", bench_name[w],
+		       (double)t / n,
+		       (double)(bench_syscalls - syscalls) / n,
+		       (double)(bench_allocs - allocs) / n,
+		       widget_tmp, 0 > rc ? " (errors)" : "");
+	}
+	return ERR_OK;
+}
@@ -0,0 +1,134 @@
+/* Compare this values with VERSION_MAJOR and VERSION_MINOR from `config.mk`.
+ * They are here not to piss you off but for that you didn't compile
+ * incompatible versions of `config.h` and the rest of the code. */
+#define CONFIG_VERSION_MAJOR 1
+#define CONFIG_VERSION_MINOR 6
+
+#define WIDGET_BUFLEN  32
+#define STATUS_BUFLEN  256
+
+static const char *status_begin = " ";
+static const char *status_delim = " | ";
+static const char *status_end = " ";
+/* appended to the last output of a widget that missed its deadline */
+static const char *status_stale = "~";
+
+/* UP_ADAPTIVE max periods are that many times longer on battery */
+static const long adaptive_battery_stretch = 4;
+
+static const struct mktimes_arg farg_wallclock_localtime = {
+	.fmt="%u %d%m%y %H%M%S%z", .tzname=NULL
+};
+static const struct getdiskusage_arg farg_fsavail_root = {
+	.path="/", .name="/", .mode=1
+};
+/* Batteries reporting charge instead of energy have "charge_full_design",
+ * "charge_now" and "current_now" attributes, power is in amperes then. */
+static const struct getbattery_arg farg_power_BAT0 = {
+	.dir="/sys/class/power_supply/BAT0",
+	.uevent="uevent",
+	.present="present",
+	.energy_max="energy_full_design",
+	.energy_now="energy_now",
+	.power_now="power_now",
+	.status="status",
+	.status_match_count = 3,
+	.status_match = (const char*[]) {
+		"Discharging\n", "Charging\n", "Full\n"
+	},
+	.status_output = (const char*[]) {
+		"-", "+", "*"
+	},
+	.status_undef = "?",
+	.listen = 1
+};
+static const struct gettemperature_arg farg_temp_CPU = {
+	.dir="/sys/devices/platform/coretemp.0",
+	.sensor="temp1_input"
+};
+/* Aggregate line of /proc/stat only, per-core modes need about 100 bytes
+ * more per core */
+static const struct src_readfile_arg sarg_proc_stat = {
+	.path="/proc/stat", .buflen=256
+};
+static const struct getcpu_arg farg_cpu = {
+	.mode=0, .name=NULL
+};
+static const struct src_readfile_arg sarg_proc_meminfo = {
+	.path="/proc/meminfo", .buflen=4096
+};
+static const struct getmemory_arg farg_memory = {
+	.mode=1, .name="M"
+};
+/* Stall of tasks waiting for cpu, memory and io, redrawn as soon as it
+ * crosses the trigger and on the slow update while it decays */
+static const struct getpressure_arg farg_pressure = {
+	.name="P", .trigger="some 150000 2000000"
+};
+/* Lines of /proc/diskstats up to the last device of `getdiskio` */
+static const struct src_readfile_arg sarg_proc_diskstats = {
+	.path="/proc/diskstats", .buflen=8192
+};
+static const struct getdiskio_arg farg_diskio_sda = {
+	.name="D", .devices=(const char *[]){"sda", NULL},
+	.show=GETDISKIO_BYTES|GETDISKIO_AWAIT
+};
+/* Segments set by other programs, e.g.
+ * echo "mail 3 new" | nc -U "$XDG_RUNTIME_DIR/dwmstatus.sock" */
+static const struct src_segments_arg sarg_segments = {
+	.path="dwmstatus.sock", .interval=500
+};
+static const struct getsegment_arg farg_segment_mail = {
+	.name="mail"
+};
+static const struct getnetwork_arg farg_network_wlan0 = {
+	.if_name = "wlan0",
+	.vi_name = "W",
+	.view_rates = 1
+};
+static const struct getnetwork_arg farg_network_wlan0_ap = {
+	.if_name = "wlan0_ap",
+	.vi_name = "AP",
+	.view_rates = 1
+};
+
+static const Source source[] = {
+	/* collect, ctx_size, arg */
+	{ src_rtnl, sizeof(struct src_rtnl_ctx), {0} },
+	{ src_readfile, SRC_READFILE_CTX_SIZE(256), {.v = &sarg_proc_stat} },
+	{ src_segments, sizeof(struct src_segments_ctx), {.v = &sarg_segments} },
+	{ src_readfile, SRC_READFILE_CTX_SIZE(8192), {.v = &sarg_proc_diskstats} },
+	{ src_readfile, SRC_READFILE_CTX_SIZE(4096), {.v = &sarg_proc_meminfo} },
+};
+static const Widget widget[] = {
+	/* func, buflen, ctx_size, arg, src, deadline (milliseconds) */
+	{ getnetwork, 2*WIDGET_BUFLEN, sizeof(struct getnetwork_ctx), {.v = &farg_network_wlan0_ap}, (const short[]){0, -1} },
+	{ getnetwork, 2*WIDGET_BUFLEN, sizeof(struct getnetwork_ctx), {.v = &farg_network_wlan0}, (const short[]){0, -1} },
+	{ getdiskusage, 1*WIDGET_BUFLEN, 0, {.v = &farg_fsavail_root}, NULL, 1000 },
+	{ gettemperature, 1*WIDGET_BUFLEN, sizeof(struct gettemperature_ctx), {.v = &farg_temp_CPU} },
+	{ getcpu, 1*WIDGET_BUFLEN, GETCPU_CTX_SIZE(0), {.v = &farg_cpu}, (const short[]){1, -1} },
+	{ getmemory, 1*WIDGET_BUFLEN, 0, {.v = &farg_memory}, (const short[]){4, -1} },
+	{ getpressure, 1*WIDGET_BUFLEN, sizeof(struct getpressure_ctx), {.v = &farg_pressure} },
+	{ getdiskio, 1*WIDGET_BUFLEN, sizeof(struct getdiskio_ctx), {.v = &farg_diskio_sda}, (const short[]){3, -1} },
+	{ getbattery, 1*WIDGET_BUFLEN, sizeof(struct getbattery_ctx), {.v = &farg_power_BAT0} },
+	{ mktimes, 1*WIDGET_BUFLEN, sizeof(struct mktimes_ctx), {.v = &farg_wallclock_localtime} },
+	/* add it to `update_widgets` in an UP_ONCE update, which opens the socket
+	{ getsegment, 1*WIDGET_BUFLEN, 0, {.v = &farg_segment_mail}, (const short[]){2, -1} }, */
+};
+static const Update update[] = {
+	/* type, arg (milliseconds) */
+	{ UP_WALLCLOCK, {.wallclock={1000, 0}} },
+	{ UP_WALLCLOCK, {.wallclock={2000, 0}} },
+	/* slow-changing values */
+	{ UP_ADAPTIVE, {.adaptive={2000, 120000}} },
+	/* battery changes are pushed by kernel, this is a fallback */
+	{ UP_WALLCLOCK, {.wallclock={60000, 0}} },
+};
+static const short *(update_widgets[]) = {
+	/* negative-terminated */
+	(const short[]) {9, -1},
+	(const short[]) {0, 1, 4, 5, 7, -1},
+	(const short[]) {2, 3, 6, -1},
+	(const short[]) {8, -1},
+};
+
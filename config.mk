@@ -1,9 +1,17 @@
 NAME = dwmstatus
 VERSION_MAJOR = 1
-VERSION_MINOR = 3
+VERSION_MINOR = 6
 
 NICE_LVL = 9
 #DEBUGFLAGS = -DDEBUG_NO_X11 -DDEBUG_STDOUT
+# per-widget latency histograms (dumped on SIGUSR1), perf counters too
+#PROFILEFLAGS = -DPROFILE
+#PROFILEFLAGS = -DPROFILE -DPROFILE_PERF
+# read attributes of widgets due together in one io_uring(7) batch, falls
+# back to plain reads where it's unavailable
+#IOFLAGS = -DIO_URING
+# lock state of widgets in memory, RLIMIT_MEMLOCK must allow it
+#MEMFLAGS = -DARENA_MLOCK
 
 # paths
 PREFIX = ~/.local
@@ -14,17 +22,17 @@ X11LIB = /usr/lib
 
 # includes and libs
 INCS = -I. -I/usr/include -I$(X11INC)
-LIBS = -L/usr/lib -lc -L$(X11LIB) -lX11
+LIBS = -L/usr/lib -lc -lrt -L$(X11LIB) -lX11
 
 # flags
-CPPFLAGS = $(DEBUGFLAGS) \
+CPPFLAGS = $(DEBUGFLAGS) $(PROFILEFLAGS) $(IOFLAGS) $(MEMFLAGS) \
 	   -DNAME=\"$(NAME)\" \
 	   -DVERSION_MAJOR=$(VERSION_MAJOR) \
 	   -DVERSION_MINOR=$(VERSION_MINOR) \
 	   -DNICE_LVL=$(NICE_LVL) \
 	   -D_DEFAULT_SOURCE
-CFLAGS = -std=c11 -pedantic -Wall -Os $(INCS) $(CPPFLAGS)
-LDFLAGS = -s $(LIBS)
+CFLAGS = -std=c11 -pedantic -Wall -Os -pthread $(INCS) $(CPPFLAGS)
+LDFLAGS = -s -pthread $(LIBS)
 
 # compiler and linker
 CC = gcc
@@ -9,30 +9,50 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <ifaddrs.h>
 #include <limits.h>
 #include <linux/if_link.h>
+#ifdef IO_URING
+#include <linux/io_uring.h>
+#endif
+#ifdef PROFILE_PERF
+#include <linux/perf_event.h>
+#endif
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <net/if.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#if defined(PROFILE_PERF) || defined(IO_URING)
+#include <sys/syscall.h>
+#endif
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <X11/Xlib.h>
 
 #include "util.h"
+#include "shm.h"
 
 typedef union Arg {
 	int i;
@@ -48,25 +68,44 @@ enum ErrorNum {
 	ERR_INVALID_INPUT  = 9,
 };
 
+/* All periods are in milliseconds */
 enum UpdateType {
-	UP_ONCE,
-	UP_ATLEAST,
-	UP_WALLCLOCK,	/* wallclock.wait   -- update each `.wait` seconds
-			 * wallclock.offset -- offset updates by `.offset` seconds from Unix-time */
+	UP_ONCE,	/* once.delay       -- update once, `.delay` after start */
+	UP_ATLEAST,	/* atleast.wait     -- keep at least `.wait` between the end
+			 *                     of an update and the start of the next one */
+	UP_WALLCLOCK,	/* wallclock.wait   -- update each `.wait`
+			 * wallclock.offset -- offset updates by `.offset` from Unix-time */
+	UP_ADAPTIVE,	/* adaptive.wait    -- update each `.wait` while output changes,
+			 *                     double the period while it doesn't
+			 * adaptive.max     -- up to `.max`, `adaptive_battery_stretch`
+			 *                     times longer on battery */
 };
 
 typedef union UpdateArg {
 	struct timespec ts;
 	struct {
-		time_t wait;
-		time_t offset;
+		long wait;
+		long offset;
 	} wallclock;
+	struct {
+		long wait;
+	} atleast;
+	struct {
+		long delay;
+	} once;
+	struct {
+		long wait;
+		long max;
+	} adaptive;
 } UpdateArg;
 
 typedef union UpdateCtx {
 	struct {
-		struct timespec last;
-		struct timespec next;
+		struct timespec last;	/* CLOCK_REALTIME of the last update */
+		int64_t next;		/* CLOCK_MONOTONIC deadline, ns */
+		short heap_i;		/* position in `sched_heap`, -1 -- none */
+		long period;		/* current UP_ADAPTIVE period, ms */
+		unsigned long wakeups;	/* updates done */
 	};
 } UpdateCtx;
 
@@ -83,17 +122,166 @@ typedef struct Widget {
 	const size_t buflen;
 	const size_t ctx_size;
 	const Arg arg;
+	const short *src;	/* `source[]` used by the widget, negative-terminated,
+				 * NULL -- none */
+	const int deadline;	/* ms, >0 -- the widget may block: it runs on a
+				 * worker thread and can't use sources or watches */
 } Widget;
 
+/* Data shared by widgets, collected once per tick before the first of its
+ * widgets runs. */
+typedef struct Source {
+	int (*collect)(void *ctx, const Arg arg);
+	const size_t ctx_size;
+	const Arg arg;
+} Source;
+
+/* Where the widget output is in the status string */
+typedef struct WidgetOut {
+	size_t len;	/* length of output in the widget buffer */
+	size_t off;	/* offset of the segment in `status` */
+	size_t seg;	/* length of the segment in `status` */
+	bool dirty;	/* output changed since the status was composed */
+} WidgetOut;
+
+/* Raw values of a widget run, exported with its output */
+typedef struct WidgetVal {
+	int64_t time_ns;	/* CLOCK_REALTIME of the run */
+	ssize_t rc;
+	short n;
+	int64_t v[DWMSTATUS_SHM_VALUES];
+} WidgetVal;
+
+/* Run of a widget with a deadline on a worker thread. Main thread moves it
+ * from JOB_IDLE to JOB_QUEUED, a worker to JOB_RUNNING and JOB_DONE, main
+ * thread takes the output and moves it back to JOB_IDLE. Fields are owned
+ * by whoever moved `state` last. */
+enum JobState {
+	JOB_IDLE,
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_DONE,
+};
+
+typedef struct Job {
+	_Atomic int state;
+	char *buf;		/* output of the run */
+	ssize_t rc;
+	int64_t start;		/* CLOCK_MONOTONIC when queued, ns */
+	int64_t ns;		/* duration of the run */
+	WidgetVal val;
+	bool stale;		/* deadline passed, output is marked */
+	bool changed;		/* output changed since the last `run_job` */
+	unsigned long runs,	/* runs queued */
+		      late,	/* runs past the deadline */
+		      skipped;	/* runs not queued, previous one outstanding */
+} Job;
+
+#ifdef PROFILE
+/* Latency histogram bucket `i` counts calls which took [2^i, 2^(i+1)) ns */
+#define PROFILE_BUCKETS 32
+typedef struct Profile {
+	unsigned long calls,
+		      errors;
+	int64_t ns_total,
+		ns_max;
+	unsigned long hist[PROFILE_BUCKETS];
+	uint64_t instructions,	/* with PROFILE_PERF only */
+		 ctxsw;
+} Profile;
+
+typedef struct ProfileMark {
+	int64_t ns;
+	bool perf;
+	uint64_t instructions,
+		 ctxsw;
+} ProfileMark;
+
+#define PROFILE_BEGIN(m, perf) ProfileMark m; profile_mark(&m, (perf))
+#define PROFILE_END(m, prof, err) profile_add((prof), &m, (err))
+#else
+#define PROFILE_BEGIN(m, perf)
+#define PROFILE_END(m, prof, err) ((void)(err))
+#endif
+
+/* record/replay of widget inputs, see `trace.h`. Widgets with a deadline
+ * run on the main thread while tracing, in order. */
+#ifdef TRACE
+#define TRACE_CALL(op, who, arg) trace_call((op), (who), (arg))
+#define TRACE_INLINE (TRACE_OFF != trace_mode)
+#else
+#define TRACE_CALL(op, who, arg) ((void)0)
+#define TRACE_INLINE 0
+#endif
+
+/* Event source watched by the main loop.
+ * `cb` returns: <0 -- stop watching `fd`;
+ *                0 -- nothing else to do;
+ *               >0 -- re-run `owner` widget, or every widget of `source`. */
+typedef struct Watch {
+	int fd;
+	short owner;	/* widget which registered `fd`, -1 -- none */
+	short source;	/* source which registered `fd`, -1 -- none */
+	int (*cb)(int fd, uint32_t events, void *data);
+	void *data;
+} Watch;
+
 /* functions */
-static void *ecalloc(size_t, size_t);
+static void *arena_take(size_t, size_t);
+static void arena_layout(void);
+#ifdef IO_URING
+static void uring_batch(int64_t);
+static void uring_register(void);
+static unsigned uring_reap(unsigned long);
+static void uring_setup(void);
+#endif
+static void job_collect(short);
+static void jobs_arm(void);
+static int jobs_done(int, uint32_t, void *);
+static int jobs_late(int, uint32_t, void *);
 static void init_update(int, UpdateCtx **);
-static void init_widget(int, char **, void **);
 static void loop(void);
 static void push_status(const char *restrict);
+static int clock_was_set(int, uint32_t, void *);
+static void clockset_arm(void);
+static void print_stats(FILE *);
+#ifdef PROFILE
+static void profile_add(Profile *, const ProfileMark *, bool);
+static void profile_mark(ProfileMark *, bool);
+static void profile_print(FILE *, const char *, int, const Profile *);
+#endif
+static void collect_sources(short);
+static void compose_status(short);
+static void dispatch(Watch *, uint32_t);
+static void reschedule_all(void);
+static void run_due(void);
+static void run_source(short);
+static void adaptive_reset(short);
+static bool run_job(short);
+static bool run_update(short);
+static bool run_widget(short);
+static int sched_expired(int, uint32_t, void *);
+static int64_t sched_next(short, int64_t, int64_t);
+static void sched_arm(void);
+static void sched_set(short, int64_t);
+static void sched_sift(short);
+static void setup(void);
 static void setup_signals(void);
+static void *status_writer(void *);
+static void sighandle_dumpnow(int);
 static void sighandle_exitnow(int);
-static void update_status(void);
+static bool update_status(void);
+static void writer_start(void);
+static void writer_stop(void);
+static int watch_fd(int, uint32_t, int (*)(int, uint32_t, void *), void *);
+static void unwatch_fd(int);
+static bool widget_keep(short, const char *);
+static void widget_value(int, int64_t);
+static void shm_publish(void);
+static void shm_start(void);
+static void *widget_source(short);
+static void *worker(void *);
+static void workers_start(void);
 void die(enum ErrorNum);
 
 /* variables */
@@ -101,103 +289,686 @@ void die(enum ErrorNum);
 static Display *dpy;
 #endif
 static char *restrict status;
+static bool status_dirty;
+
+/* Status writer thread, owns the X connection once started. The latest
+ * status waits for it in a single-slot mailbox, a newer one replaces it. */
+static pthread_t writer;
+static bool writer_running;
+static pthread_mutex_t mbox_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mbox_cond = PTHREAD_COND_INITIALIZER;
+static char *mbox;
+static bool mbox_full;
+static bool mbox_closed;
+static bool writer_done;	/* writer has returned, under `mbox_lock` */
+static bool writer_stuck;	/* didn't return in time, still owns `dpy` */
+static struct {
+	unsigned long pushes,		/* statuses written */
+		      coalesced;	/* statuses replaced before written */
+	int64_t write_ns_total,		/* time spent by writer in X */
+		write_ns_max,
+		post_ns_max;		/* time spent by main loop posting */
+} push_stats;
+
+#ifdef PROFILE
+static Profile *widget_prof;
+static Profile push_prof;	/* X writes, under `mbox_lock` */
+#ifdef PROFILE_PERF
+static int perf_fd = -1;	/* group of main thread counters */
+#endif
+#endif
 static struct timespec now;
 static volatile int exitnow;
+static volatile int dumpnow;
+static int epfd = -1;
+static int sched_tfd = -1;	/* CLOCK_MONOTONIC, armed at the closest deadline */
+static int clockset_tfd = -1;	/* CLOCK_REALTIME, only reports clock steps */
+/* per thread: the writer and workers never see the main thread's ones */
+static _Thread_local short cur_widget = -1;	/* widget being run, -1 -- none */
+static _Thread_local short cur_source = -1;	/* source being collected, -1 -- none */
+static _Thread_local short job_widget = -1;	/* run by this worker, -1 -- none */
+static unsigned long tick = 1;	/* main loop iteration */
+static int64_t start_ns;	/* CLOCK_MONOTONIC at start */
+static bool on_battery;		/* set by power supply widgets */
 
 static UpdateCtx **update_ctx;
 static void **widget_ctx;
 static char **widget_buf;
+static char *widget_tmp;	/* output of the running widget */
+static WidgetOut *widget_out;
+static WidgetVal *widget_val;
+static _Thread_local WidgetVal *cur_val;	/* of the running widget */
+static struct dwmstatus_shm *shm;	/* export, NULL -- none, see `shm.h` */
+static char shm_name[32];
+static bool shm_dirty;			/* widgets ran since the last export */
+static void **source_ctx;
+static unsigned long *source_tick;	/* tick of the last collection */
+static int *source_rc;			/* result of the last collection */
+static Job *job;			/* of widgets with a deadline */
+static char *arena;			/* all of the above, see `arena_layout` */
+static size_t arena_len;
+static sem_t job_sem;			/* counts queued jobs */
+static int job_efd = -1;		/* eventfd, signalled by workers */
+static int job_tfd = -1;		/* CLOCK_MONOTONIC, closest job deadline */
+#ifdef IO_URING
+#define URING_ENTRIES 32	/* reads per batch, registered files */
+/* io_uring(7) for batched reads of `sysattr_list` */
+static struct {
+	int fd;			/* -1 -- unavailable */
+	unsigned *sq_head,
+		 *sq_tail,
+		 sq_mask;
+	unsigned *cq_head,
+		 *cq_tail,
+		 cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned long gen;	/* `sysattr_gen` of registered files */
+	unsigned nfiles;
+	SysAttr *file[URING_ENTRIES];	/* registered files */
+	unsigned long batches,
+		      reads;
+} uring = {.fd = -1};
+#endif
 
 /* Add your widgets to `widgets.h` file */
 #include "widgets.h"
 
 /* Configuration, allows nested code to use variables above */
+#ifndef BENCH
 #include "config.h"
+#else
+/* `make bench` configuration and driver */
+#include "bench.h"
+#endif
 #if VERSION_MAJOR != CONFIG_VERSION_MAJOR \
  || VERSION_MINOR != CONFIG_VERSION_MINOR
 #error "`config.h` has different API version from config.mk. Check your `config.h` for compatibility and change its version."
 #endif
 
-static void *ecalloc(size_t nmemb, size_t size)
-{
-	void *m = calloc(nmemb, size);
-	if (m == NULL) die(ERR_PANIC);
-	return m;
-}
+#define WATCH_MAX 16	/* event sources registered by widgets */
+#define EVENTS_MAX 8	/* events handled per `epoll_wait` */
+#define WORKERS_MAX 2	/* threads running widgets with a deadline */
+#define WRITER_STOP_WAIT 1	/* s, for the status writer on exit */
+
+static Watch watch[4 + WATCH_MAX];
+
+/* binary min-heap of updates ordered by `UpdateCtx.next` */
+static short sched_heap[COUNT(update)];
+static short sched_len;
+
+#ifdef TRACE
+/* `make trace` record/replay of widget inputs */
+#include "trace.h"
+#endif
 
 static void init_update(int u, UpdateCtx **u_ctx)
 {
-	switch(update[u].type) {
+	const Update *up = &update[u];
+	int64_t start = clock_ns(CLOCK_MONOTONIC);
+
+	(*u_ctx)->heap_i = -1;
+
+	switch(up->type) {
+	case UP_ONCE:
+		if (0 > up->arg.once.delay)
+			goto invalid;
+		sched_set(u, start + up->arg.once.delay * 1000000);
+		break;
+	case UP_ATLEAST:
+		if (0 >= up->arg.atleast.wait)
+			goto invalid;
+		sched_set(u, start);
+		break;
 	case UP_WALLCLOCK:
-		*u_ctx = (UpdateCtx *)ecalloc(1, sizeof(UpdateCtx));
+		if (0 >= up->arg.wallclock.wait)
+			goto invalid;
+		sched_set(u, start);
+		break;
+	case UP_ADAPTIVE:
+		if (0 >= up->arg.adaptive.wait
+		|| up->arg.adaptive.wait > up->arg.adaptive.max)
+			goto invalid;
+		(*u_ctx)->period = up->arg.adaptive.wait;
+		sched_set(u, start);
 		break;
 	default:
 		/* undefined */
 		die(ERR_PANIC);
 	}
+	return;
+
+invalid:
+	ERROR("Update %d has invalid period.", u);
+	die(ERR_INVALID_INPUT);
 }
 
-static void init_widget(int w, char **w_buf, void **w_ctx)
+/* Take `size` bytes of `arena` aligned to `align` (power of 2).
+ * @return NULL - `arena` isn't there yet, only its length is counted */
+static void *arena_take(size_t size, size_t align)
 {
-	/* widget buffer */
-	size_t w_buflen = widget[w].buflen;
-	if (0 < w_buflen)
-		*w_buf = (char *)ecalloc(w_buflen, sizeof(char));
+	size_t off = (arena_len + align - 1) & ~(align - 1);
 
-	/* widget context */
-	size_t w_ctx_size = widget[w].ctx_size;
-	if (0 < w_ctx_size)
-		*w_ctx = (void *)ecalloc(1, w_ctx_size);
+	arena_len = off + size;
+	return arena ? arena + off : NULL;
 }
 
-static void update_status(void)
+/* Lay out the state of updates, widgets, sources and of the status string
+ * in `arena`, hot data first. Sizes come from the config only, so the first
+ * run with no `arena` yet measures it. */
+static void arena_layout(void)
 {
-	char *cur = status;
-	short off;
+	const size_t line = 64;	/* cache line */
+	const size_t word = _Alignof(max_align_t);
+	UpdateCtx *u_ctx;
+	size_t buflen_max = 1;
+
+	arena_len = 0;
+	update_ctx = arena_take(COUNT(update) * sizeof(void *), line);
+	u_ctx = arena_take(COUNT(update) * sizeof(UpdateCtx), word);
+	widget_out = arena_take(COUNT(widget) * sizeof(WidgetOut), word);
+	widget_val = arena_take(COUNT(widget) * sizeof(WidgetVal), word);
+	widget_buf = arena_take(COUNT(widget) * sizeof(void *), word);
+	widget_ctx = arena_take(COUNT(widget) * sizeof(void *), word);
+	source_ctx = arena_take(COUNT(source) * sizeof(void *), word);
+	source_tick = arena_take(COUNT(source) * sizeof(*source_tick), word);
+	source_rc = arena_take(COUNT(source) * sizeof(*source_rc), word);
+	for(int u=0; arena && COUNT(update)>u; ++u)
+		update_ctx[u] = &u_ctx[u];
 
-	if (status_begin) {
-		off = sprintf(cur, "%s", status_begin);
-		cur += off;
+	/* strings, packed */
+	status = arena_take(STATUS_BUFLEN, line);
+	for(int w=0; COUNT(widget)>w; ++w) {
+		char *buf = widget[w].buflen ? arena_take(widget[w].buflen, 1) : NULL;
+		if (arena)
+			widget_buf[w] = buf;
+		if (buflen_max < widget[w].buflen)
+			buflen_max = widget[w].buflen;
 	}
+	widget_tmp = arena_take(buflen_max, 1);
 
-	for(short w=0; COUNT(widget)>w; ++w)
-	{
-		if (NULL == widget_buf[w])
+	/* contexts, a line apart so workers don't share them */
+	for(int w=0; COUNT(widget)>w; ++w) {
+		void *ctx = widget[w].ctx_size ? arena_take(widget[w].ctx_size, line) : NULL;
+		if (arena)
+			widget_ctx[w] = ctx;
+	}
+	for(int p=0; COUNT(source)>p; ++p) {
+		void *ctx = source[p].ctx_size ? arena_take(source[p].ctx_size, line) : NULL;
+		if (arena)
+			source_ctx[p] = ctx;
+	}
+
+	/* cold: jobs, the writer, statistics */
+	job = arena_take(COUNT(widget) * sizeof(Job), line);
+	for(int w=0; COUNT(widget)>w; ++w) {
+		if (0 >= widget[w].deadline || 0 == widget[w].buflen)
 			continue;
-		off = snprintf(cur, widget[w].buflen, "%s", widget_buf[w]);
-		off = off > widget[w].buflen ? widget[w].buflen : off;
-		cur += off;
+		char *buf = arena_take(widget[w].buflen, line);
+		if (arena)
+			job[w].buf = buf;
+	}
+	/* mailbox and the copy the writer works on */
+	mbox = arena_take(2 * STATUS_BUFLEN, line);
+#ifdef PROFILE
+	widget_prof = arena_take(COUNT(widget) * sizeof(Profile), line);
+#endif
+}
 
-		if (status_delim && COUNT(widget)-1 > w) {
-			off = sprintf(cur, "%s", status_delim);
-			cur += off;
-		}
+/* Append `len` bytes of `src` to the status string at `cur`, as much as
+ * fits in. @return new end of the string */
+static size_t status_put(size_t cur, const char *src, size_t len)
+{
+	if (STATUS_BUFLEN - 1 - cur < len)
+		len = STATUS_BUFLEN - 1 - cur;
+	memcpy(status + cur, src, len);
+	return cur + len;
+}
+
+/* Rebuild the status string from widget `from` to the end */
+static void compose_status(short from)
+{
+	size_t cur = 0;
+
+	if (0 < from)
+		cur = widget_out[from].off;
+	else if (status_begin)
+		cur = status_put(cur, status_begin, strlen(status_begin));
+
+	for(short w=from; COUNT(widget)>w; ++w)
+	{
+		WidgetOut *out = &widget_out[w];
+
+		out->off = cur;
+		if (widget_buf[w])
+			cur = status_put(cur, widget_buf[w], out->len);
+		out->seg = cur - out->off;
+		out->dirty = false;
+
+		if (status_delim && COUNT(widget)-1 > w)
+			cur = status_put(cur, status_delim, strlen(status_delim));
 	}
 
-	if (status_end) {
-		off += sprintf(cur, "%s", status_end);
-		cur += off;
+	if (status_end)
+		cur = status_put(cur, status_end, strlen(status_end));
+
+	status[cur] = '\0';
+}
+
+/* Put changed widget outputs into the status string. Segments that kept
+ * their length are overwritten in place, the rest of the string is rebuilt
+ * from the first one that didn't.
+ * @return true - status string changed */
+static bool update_status(void)
+{
+	short w;
+
+	if (!status_dirty)
+		return false;
+	status_dirty = false;
+
+	for(w=0; COUNT(widget)>w; ++w)
+	{
+		WidgetOut *out = &widget_out[w];
+
+		if (!out->dirty)
+			continue;
+		if (out->len != out->seg)
+			break;
+		memcpy(status + out->off, widget_buf[w], out->len);
+		out->dirty = false;
 	}
+	if (COUNT(widget) > w)
+		compose_status(w);
 
-	*cur = '\0';
+	return true;
 }
 
+/* Hand the status over to the writer, never waits for X */
 static void push_status(const char *restrict src)
 {
+	int64_t t = clock_ns(CLOCK_MONOTONIC);
+
+	pthread_mutex_lock(&mbox_lock);
+	if (mbox_full)
+		++push_stats.coalesced;
+	strcpy(mbox, src);
+	mbox_full = true;
+	pthread_cond_signal(&mbox_cond);
+	pthread_mutex_unlock(&mbox_lock);
+
+	t = clock_ns(CLOCK_MONOTONIC) - t;
+	if (push_stats.post_ns_max < t)
+		push_stats.post_ns_max = t;
+}
+
+static void *status_writer(void *arg)
+{
+	char *buf = (char *)arg;
+
+	pthread_mutex_lock(&mbox_lock);
+	for(;;) {
+		while (!mbox_full && !mbox_closed)
+			pthread_cond_wait(&mbox_cond, &mbox_lock);
+		if (!mbox_full)
+			break;
+		strcpy(buf, mbox);
+		mbox_full = false;
+		pthread_mutex_unlock(&mbox_lock);
+
+		int64_t t = clock_ns(CLOCK_MONOTONIC);
+		PROFILE_BEGIN(mark, false);
 #ifndef DEBUG_NO_X11
-	XStoreName(dpy, DefaultRootWindow(dpy), src);
-	XSync(dpy, False);
+		XStoreName(dpy, DefaultRootWindow(dpy), buf);
+		XSync(dpy, False);
 #endif
 #ifdef DEBUG_STDOUT
-	fprintf(stdout, "%s\n", src);
+		fprintf(stdout, "%s\n", buf);
+		fflush(stdout);
+#endif
+		t = clock_ns(CLOCK_MONOTONIC) - t;
+
+		pthread_mutex_lock(&mbox_lock);
+		PROFILE_END(mark, &push_prof, false);
+		++push_stats.pushes;
+		push_stats.write_ns_total += t;
+		if (push_stats.write_ns_max < t)
+			push_stats.write_ns_max = t;
+	}
+	writer_done = true;
+	pthread_cond_broadcast(&mbox_cond);
+	pthread_mutex_unlock(&mbox_lock);
+	return NULL;
+}
+
+static void writer_start(void)
+{
+	sigset_t all, old;
+
+	/* signals are for the main loop only */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&writer, NULL, status_writer, mbox + STATUS_BUFLEN)) {
+		ERROR("Can't start status writer.");
+		die(ERR_PANIC);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	writer_running = true;
+}
+
+/* Let the writer finish the last status and wait for it, for a while: it
+ * may be blocked in X for good, on a dead or stalled server */
+static void writer_stop(void)
+{
+	struct timespec until;
+	int rc = 0;
+
+	if (!writer_running)
+		return;
+	writer_running = false;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += WRITER_STOP_WAIT;
+	pthread_mutex_lock(&mbox_lock);
+	mbox_closed = true;
+	pthread_cond_broadcast(&mbox_cond);
+	while (!writer_done && 0 == rc)
+		rc = pthread_cond_timedwait(&mbox_cond, &mbox_lock, &until);
+	writer_stuck = !writer_done;
+	pthread_mutex_unlock(&mbox_lock);
+
+	if (writer_stuck) {
+		ERROR("Status writer is stuck in X, leaving it behind.");
+		return;
+	}
+	pthread_join(writer, NULL);
+}
+
+
+#ifdef PROFILE
+static void profile_mark(ProfileMark *m, bool perf)
+{
+	m->perf = perf;
+	m->instructions = m->ctxsw = 0;
+#ifdef PROFILE_PERF
+	if (perf && 0 <= perf_fd) {
+		struct {
+			uint64_t nr;
+			uint64_t val[2];
+		} r = {0};
+		if (0 < read(perf_fd, &r, sizeof(r))) {
+			m->ctxsw = r.val[0];
+			m->instructions = r.val[1];
+		}
+	}
+#else
+	(void)perf;
+#endif
+	m->ns = clock_ns(CLOCK_MONOTONIC);
+}
+
+static void profile_add(Profile *p, const ProfileMark *begin, bool error)
+{
+	ProfileMark end;
+	int b;
+
+	profile_mark(&end, begin->perf);
+	int64_t ns = end.ns - begin->ns;
+
+	++p->calls;
+	if (error)
+		++p->errors;
+	p->ns_total += ns;
+	if (p->ns_max < ns)
+		p->ns_max = ns;
+	b = 0 < ns ? 63 - __builtin_clzll((unsigned long long)ns) : 0;
+	++p->hist[PROFILE_BUCKETS > b ? b : PROFILE_BUCKETS - 1];
+	p->instructions += end.instructions - begin->instructions;
+	p->ctxsw += end.ctxsw - begin->ctxsw;
+}
+
+static void profile_print(FILE *f, const char *what, int id, const Profile *p)
+{
+	fprintf(f, "%s=%d calls=%lu errors=%lu ns_total=%lld ns_max=%lld",
+	        what, id, p->calls, p->errors,
+	        (long long)p->ns_total, (long long)p->ns_max);
+#ifdef PROFILE_PERF
+	fprintf(f, " instructions=%llu ctxsw=%llu",
+	        (unsigned long long)p->instructions,
+	        (unsigned long long)p->ctxsw);
+#endif
+	fprintf(f, " hist_log2_ns=");
+	for(int b=0; PROFILE_BUCKETS>b; ++b)
+		fprintf(f, b ? ",%lu" : "%lu", p->hist[b]);
+	fputc('\n', f);
+}
+#endif
+
+#ifdef PROFILE_PERF
+/* Count context switches and user-space instructions of the main thread */
+static void perf_open(void)
+{
+	struct perf_event_attr pa = {
+		.type = PERF_TYPE_SOFTWARE,
+		.size = sizeof(pa),
+		.config = PERF_COUNT_SW_CONTEXT_SWITCHES,
+		.read_format = PERF_FORMAT_GROUP
+	};
+
+	perf_fd = syscall(SYS_perf_event_open, &pa, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	if (0 > perf_fd) {
+		NOTE("perf counters are unavailable. %s", strerror(errno));
+		return;
+	}
+	pa.type = PERF_TYPE_HARDWARE;
+	pa.config = PERF_COUNT_HW_INSTRUCTIONS;
+	pa.exclude_kernel = 1;
+	pa.exclude_hv = 1;
+	if (0 > syscall(SYS_perf_event_open, &pa, 0, -1, perf_fd, PERF_FLAG_FD_CLOEXEC))
+		NOTE("instructions counter is unavailable. %s", strerror(errno));
+}
 #endif
+
+#ifdef IO_URING
+/* Start `uring`, leave it off if the kernel can't */
+static void uring_setup(void)
+{
+	struct io_uring_params p = {0};
+	int fd = syscall(SYS_io_uring_setup, URING_ENTRIES, &p);
+	char *rings;
+
+	if (0 > fd)
+		goto error;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		errno = ENOSYS;
+		goto error;
+	}
+	size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	rings = mmap(NULL, sq_len > cq_len ? sq_len : cq_len,
+	             PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+	             fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == rings)
+		goto error;
+	uring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+	                  PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+	                  fd, IORING_OFF_SQES);
+	if (MAP_FAILED == uring.sqes)
+		goto error;
+
+	uring.sq_head = (unsigned *)(rings + p.sq_off.head);
+	uring.sq_tail = (unsigned *)(rings + p.sq_off.tail);
+	uring.sq_mask = *(unsigned *)(rings + p.sq_off.ring_mask);
+	uring.cq_head = (unsigned *)(rings + p.cq_off.head);
+	uring.cq_tail = (unsigned *)(rings + p.cq_off.tail);
+	uring.cq_mask = *(unsigned *)(rings + p.cq_off.ring_mask);
+	uring.cqes = (struct io_uring_cqe *)(rings + p.cq_off.cqes);
+	/* SQEs are submitted in order, their index array never changes */
+	for(unsigned i=0; p.sq_entries>i; ++i)
+		((unsigned *)(rings + p.sq_off.array))[i] = i;
+	uring.fd = fd;
+	return;
+
+error:
+	NOTE("io_uring is unavailable, attributes are read one by one. %s",
+	     strerror(errno));
+	if (0 <= fd)
+		close(fd);
+}
+
+/* Register files of `sysattr_list` anew if any has changed */
+static void uring_register(void)
+{
+	int fds[URING_ENTRIES];
+	unsigned n = 0;
+
+	if (uring.gen == sysattr_gen)
+		return;
+	uring.gen = sysattr_gen;
+	if (0 < uring.nfiles)
+		syscall(SYS_io_uring_register, uring.fd, IORING_UNREGISTER_FILES, NULL, 0);
+	uring.nfiles = 0;
+
+	for(SysAttr *a = sysattr_list; a && URING_ENTRIES > n; a = a->next)
+		if (0 < a->fd) {
+			uring.file[n] = a;
+			fds[n++] = a->fd;
+		}
+	if (0 == n)
+		return;
+	if (0 > syscall(SYS_io_uring_register, uring.fd, IORING_REGISTER_FILES, fds, n)) {
+		ERROR("Can't register files with io_uring. %s", strerror(errno));
+		return;
+	}
+	uring.nfiles = n;
+}
+
+/* Hand completions over to their attributes as batch `id`
+ * @return number of completions */
+static unsigned uring_reap(unsigned long id)
+{
+	unsigned head = *uring.cq_head,
+		 tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE),
+		 n = 0;
+
+	for(; tail != head; ++head, ++n) {
+		const struct io_uring_cqe *cqe = &uring.cqes[head & uring.cq_mask];
+		SysAttr *a = uring.file[cqe->user_data];
+		a->res = cqe->res;
+		a->batch = id;
+	}
+	__atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+/* Read attributes of widgets due at `mono` and of sources they use ahead,
+ * with one syscall. `sysattr_read` takes the results until `sysattr_batch`
+ * is reset. */
+static void uring_batch(int64_t mono)
+{
+	bool due_w[COUNT(widget)] = {0},
+	     due_p[COUNT(source)] = {0};
+	unsigned tail, n = 0, done = 0;
+
+	if (0 > uring.fd || TRACE_INLINE)
+		return;
+	uring_register();
+
+	for(short u=0; COUNT(update)>u; ++u) {
+		if (0 > update_ctx[u]->heap_i || update_ctx[u]->next > mono)
+			continue;
+		for(const short *w = update_widgets[u]; -1 < *w; ++w) {
+			/* widgets with a deadline read on their own */
+			if (0 < widget[*w].deadline || 0 == widget[*w].buflen)
+				continue;
+			due_w[*w] = true;
+			for(const short *p = widget[*w].src; p && -1 < *p; ++p)
+				if (tick != source_tick[*p])
+					due_p[*p] = true;
+		}
+	}
+
+	tail = *uring.sq_tail;
+	for(unsigned i=0; uring.nfiles>i; ++i) {
+		const SysAttr *a = uring.file[i];
+		if (!(0 <= a->owner && due_w[a->owner])
+		&& !(0 <= a->source && due_p[a->source]))
+			continue;
+
+		struct io_uring_sqe *sqe = &uring.sqes[(tail + n++) & uring.sq_mask];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READ;
+		sqe->flags = IOSQE_FIXED_FILE;
+		sqe->fd = i;
+		sqe->addr = (uintptr_t)a->buf;
+		sqe->len = a->buflen - 1;
+		sqe->user_data = i;
+	}
+	/* a single read costs a syscall anyway */
+	if (2 > n)
+		return;
+	__atomic_store_n(uring.sq_tail, tail + n, __ATOMIC_RELEASE);
+
+	++uring.batches;
+	while (n > done) {
+		unsigned unsubmitted = tail + n - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+		if (0 > syscall(SYS_io_uring_enter, uring.fd, unsubmitted, n - done,
+		                IORING_ENTER_GETEVENTS, NULL, 0)
+		&& EINTR != errno) {
+			ERROR("io_uring_enter returned error. %s", strerror(errno));
+			die(ERR_PANIC);
+		}
+		done += uring_reap(uring.batches);
+	}
+	uring.reads += n;
+	sysattr_batch = uring.batches;
 }
+#endif
+
+/* Runtime statistics, one `key=value` record per line */
+static void print_stats(FILE *f)
+{
+	int64_t uptime = clock_ns(CLOCK_MONOTONIC) - start_ns;
+
+	pthread_mutex_lock(&mbox_lock);
+	fprintf(f, "push pushes=%lu coalesced=%lu "
+	        "write_ns_total=%lld write_ns_max=%lld post_ns_max=%lld\n",
+	        push_stats.pushes, push_stats.coalesced,
+	        (long long)push_stats.write_ns_total,
+	        (long long)push_stats.write_ns_max,
+	        (long long)push_stats.post_ns_max);
+#ifdef PROFILE
+	profile_print(f, "push", 0, &push_prof);
+#endif
+	pthread_mutex_unlock(&mbox_lock);
 
+	for(short u=0; COUNT(update)>u && 0<uptime; ++u)
+		fprintf(f, "update=%d wakeups=%lu wakeups_per_hour=%.1f\n",
+		        u, update_ctx[u]->wakeups,
+		        update_ctx[u]->wakeups * 3600e9 / uptime);
+	fprintf(f, "arena bytes=%zu\n", arena_len);
+#ifdef IO_URING
+	fprintf(f, "uring batches=%lu reads=%lu files=%u\n",
+	        uring.batches, uring.reads, uring.nfiles);
+#endif
+	for(short w=0; COUNT(widget)>w; ++w)
+		if (0 < widget[w].deadline)
+			fprintf(f, "job=%d runs=%lu late=%lu skipped=%lu\n",
+			        w, job[w].runs, job[w].late, job[w].skipped);
+#ifdef PROFILE
+	for(short w=0; COUNT(widget)>w; ++w)
+		profile_print(f, "widget", w, &widget_prof[w]);
+#endif
+	fflush(f);
+}
 
 void die(enum ErrorNum code)
 {
+	writer_stop();
+	if (shm)
+		shm_unlink(shm_name);
 #ifndef DEBUG_NO_X11
-	if (dpy)
+	if (dpy && !writer_stuck)
 		XCloseDisplay(dpy);
 #endif
 
@@ -209,101 +980,815 @@ static void sighandle_exitnow(int signal)
 	exitnow = signal;
 }
 
+static void sighandle_dumpnow(int signal)
+{
+	dumpnow = signal;
+}
+
 static void setup_signals(void)
 {
-	struct sigaction sa;
+	struct sigaction sa = {0};
 
+	/* no SA_RESTART: signals must interrupt `epoll_wait` */
 	sa.sa_handler = sighandle_exitnow;
 	sigemptyset(&sa.sa_mask);
 	sigaction(SIGINT, &sa, NULL);
 	sigaction(SIGTERM, &sa, NULL);
 	sigaction(SIGHUP, &sa, NULL);
+
+	sa.sa_handler = sighandle_dumpnow;
+	sigaction(SIGUSR1, &sa, NULL);
 }
 
-static void loop(void)
+/* Register `fd` in the main loop. Called from a widget, the widget becomes
+ * owner of `fd` and will be re-run when `cb` asks for it.
+ * @return 0 - success
+ * @return -1 - failure, check errno */
+static int watch_fd(int fd, uint32_t events, int (*cb)(int, uint32_t, void *), void *data)
+{
+	Watch *wt = NULL;
+
+	/* the watch table and epoll belong to the main thread */
+	if (0 <= job_widget) {
+		ERROR("Widget %d has a deadline, it can't watch descriptors.", job_widget);
+		errno = EPERM;
+		return -1;
+	}
+	for(short i=0; COUNT(watch)>i; ++i)
+		if (0 > watch[i].fd) {
+			wt = &watch[i];
+			break;
+		}
+	if (!wt) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	struct epoll_event ev = {.events = events, .data.ptr = wt};
+	if (0 > epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+		return -1;
+
+	wt->fd = fd;
+	wt->owner = cur_widget;
+	wt->source = cur_source;
+	wt->cb = cb;
+	wt->data = data;
+	return 0;
+}
+
+/* Remove `fd` from the main loop, closing it is up to the caller */
+static void unwatch_fd(int fd)
+{
+	for(short i=0; COUNT(watch)>i; ++i)
+		if (fd == watch[i].fd) {
+			epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+			watch[i].fd = -1;
+			break;
+		}
+}
+
+/* Collect sources of widget `w` which weren't collected during this tick */
+static void collect_sources(short w)
+{
+	const short *src = widget[w].src;
+
+	if (!src)
+		return;
+	for(short p = *src; -1 < p; p = *(++src)) {
+		if (tick == source_tick[p])
+			continue;
+		cur_source = sysattr_source = p;
+		TRACE_CALL(TR_SOURCE, p, 0);
+		source_rc[p] = (source[p].collect)(source_ctx[p], source[p].arg);
+		cur_source = sysattr_source = -1;
+		source_tick[p] = tick;
+	}
+}
+
+/* Data of `i`-th source of the running widget.
+ * @return NULL - the source failed to collect data */
+static void *widget_source(short i)
+{
+	if (0 > cur_widget || !widget[cur_widget].src)
+		return NULL;
+	short p = widget[cur_widget].src[i];
+
+	return 0 > source_rc[p] ? NULL : source_ctx[p];
+}
+
+/* Run every widget using source `p` */
+static void run_source(short p)
 {
-	/* default_lag := now + 60s */
-	struct timespec default_lag = {.tv_sec=60, .tv_nsec=0};
-	struct timespec closest;
+	for(short w=0; COUNT(widget)>w; ++w) {
+		const short *src = widget[w].src;
+		if (!src)
+			continue;
+		for(; -1 < *src; ++src)
+			if (p == *src) {
+				if (run_widget(w))
+					adaptive_reset(w);
+				break;
+			}
+	}
+}
+
+/* Output of widget `w` changed outside of its updates, UP_ADAPTIVE ones
+ * holding it go back to their shortest period as after a changed run */
+static void adaptive_reset(short w)
+{
+	int64_t mono = clock_ns(CLOCK_MONOTONIC);
+	bool moved = false;
 
 	for(short u=0; COUNT(update)>u; ++u) {
 		const Update *up = &update[u];
 		UpdateCtx *u_ctx = update_ctx[u];
-		const short *u_wd = (const short *)update_widgets[u];
+		const short *u_wd = update_widgets[u];
+
+		if (UP_ADAPTIVE != up->type || u_ctx->period <= up->arg.adaptive.wait)
+			continue;
+		while (-1 < *u_wd && w != *u_wd)
+			++u_wd;
+		if (w != *u_wd)
+			continue;
+		u_ctx->period = up->arg.adaptive.wait;
+		int64_t next = mono + u_ctx->period * 1000000;
+		if (0 > u_ctx->heap_i || next < u_ctx->next) {
+			sched_set(u, next);
+			moved = true;
+		}
+	}
+	if (moved)
+		sched_arm();
+}
+
+/* @return true - output of the widget changed */
+static bool run_widget(short w)
+{
+	const Widget *wd = &widget[w];
+
+	if (0 == wd->buflen)
+		return false;
+	if (0 < wd->deadline && !TRACE_INLINE)
+		return run_job(w);
+
+	TRACE_CALL(TR_WIDGET, w, 0);
+	collect_sources(w);
+	widget_tmp[0] = '\0';
+	widget_val[w].n = 0;
+	PROFILE_BEGIN(mark, true);
+	cur_widget = sysattr_owner = w;
+	cur_val = &widget_val[w];
+	ssize_t rc = (wd->func)(widget_tmp, wd->buflen, widget_ctx[w], wd->arg);
+	cur_val = NULL;
+	cur_widget = sysattr_owner = -1;
+	PROFILE_END(mark, &widget_prof[w], 0 > rc);
+	widget_val[w].rc = rc;
+	widget_val[w].time_ns = clock_ns(CLOCK_REALTIME);
+	shm_dirty = true;
+
+	return widget_keep(w, widget_tmp);
+}
+
+/* Keep output `buf` of widget `w` only if it has changed
+ * @return true - output of the widget changed */
+static bool widget_keep(short w, const char *buf)
+{
+	WidgetOut *out = &widget_out[w];
+	size_t len = strnlen(buf, widget[w].buflen - 1);
+
+	if (len == out->len && !memcmp(widget_buf[w], buf, len))
+		return false;
+	memcpy(widget_buf[w], buf, len);
+	widget_buf[w][len] = '\0';
+	out->len = len;
+	out->dirty = true;
+	status_dirty = true;
+	return true;
+}
+
+/* Queue widget `w` for a worker unless its previous run is outstanding.
+ * The output comes later, `jobs_done` takes it.
+ * @return true - output of the widget changed since the last call */
+static bool run_job(short w)
+{
+	Job *j = &job[w];
+	bool changed;
+
+	if (JOB_DONE == atomic_load_explicit(&j->state, memory_order_acquire))
+		job_collect(w);
+	changed = j->changed;
+	j->changed = false;
+	if (JOB_IDLE != atomic_load_explicit(&j->state, memory_order_relaxed)) {
+		++j->skipped;
+		return changed;
+	}
+
+	++j->runs;
+	j->start = clock_ns(CLOCK_MONOTONIC);
+	atomic_store_explicit(&j->state, JOB_QUEUED, memory_order_release);
+	sem_post(&job_sem);
+	jobs_arm();
+	return changed;
+}
+
+/* Take output of the finished job of widget `w` */
+static void job_collect(short w)
+{
+	Job *j = &job[w];
+
+#ifdef PROFILE
+	ProfileMark mark = {.ns = clock_ns(CLOCK_MONOTONIC) - j->ns};
+	profile_add(&widget_prof[w], &mark, 0 > j->rc);
+#endif
+	/* a stale output always differs */
+	j->changed |= widget_keep(w, j->buf);
+	j->stale = false;
+	widget_val[w] = j->val;
+	shm_dirty = true;
+	atomic_store_explicit(&j->state, JOB_IDLE, memory_order_release);
+}
+
+/* Arm `job_tfd` at the closest deadline of outstanding jobs */
+static void jobs_arm(void)
+{
+	struct itimerspec its = {0};
+	int64_t next = INT64_MAX;
+
+	for(short w=0; COUNT(widget)>w; ++w) {
+		const Job *j = &job[w];
+		int64_t t = j->start + widget[w].deadline * (int64_t)1000000;
+		if (0 < widget[w].deadline && !j->stale && next > t
+		&& JOB_IDLE != atomic_load_explicit(&j->state, memory_order_relaxed))
+			next = t;
+	}
+	if (INT64_MAX > next) {
+		its.it_value.tv_sec = next / 1000000000;
+		its.it_value.tv_nsec = next % 1000000000;
+	}
+	if (0 > timerfd_settime(job_tfd, TFD_TIMER_ABSTIME, &its, NULL))
+		ERROR("Can't arm job timer. %s", strerror(errno));
+}
+
+/* Some workers have finished */
+static int jobs_done(int fd, uint32_t events, void *data)
+{
+	(void)events;
+	(void)data;
+	uint64_t n;
+
+	if (0 > read(fd, &n, sizeof(n)) && EAGAIN == errno)
+		return 0;
+
+	for(short w=0; COUNT(widget)>w; ++w)
+		if (0 < widget[w].deadline
+		&& JOB_DONE == atomic_load_explicit(&job[w].state, memory_order_acquire))
+			job_collect(w);
+	jobs_arm();
+	return 0;
+}
+
+/* Export raw value `i` of the running widget, see `shm.h` */
+static void widget_value(int i, int64_t v)
+{
+	if (!cur_val || 0 > i || DWMSTATUS_SHM_VALUES <= i)
+		return;
+	cur_val->v[i] = v;
+	if (cur_val->n <= i)
+		cur_val->n = i + 1;
+}
 
-		clock_gettime(CLOCK_REALTIME, &now);
+/* Some jobs are past their deadline, mark the last output of their widgets
+ * with `status_stale` */
+static int jobs_late(int fd, uint32_t events, void *data)
+{
+	(void)events;
+	(void)data;
+	uint64_t expirations;
+	size_t stale_len = strlen(status_stale);
+	int64_t mono = clock_ns(CLOCK_MONOTONIC);
+
+	if (0 > read(fd, &expirations, sizeof(expirations)) && EAGAIN == errno)
+		return 0;
+
+	for(short w=0; COUNT(widget)>w; ++w) {
+		Job *j = &job[w];
+		WidgetOut *out = &widget_out[w];
+		int state = atomic_load_explicit(&j->state, memory_order_acquire);
 
-		/* diff := next - now */
-		{
-			struct timespec diff;
-			timespec_sub(&diff, &u_ctx->next, &now);
-			if (0 <= diff.tv_sec)
-				/* too early*/ continue;
+		if (0 >= widget[w].deadline || JOB_IDLE == state || j->stale
+		|| mono < j->start + widget[w].deadline * (int64_t)1000000)
+			continue;
+		if (JOB_DONE == state) {
+			job_collect(w);
+			continue;
 		}
+		++j->late;
+		j->stale = true;
+		shm_dirty = true;
+		if (widget[w].buflen - 1 - out->len < stale_len)
+			continue;
+		memcpy(widget_buf[w] + out->len, status_stale, stale_len + 1);
+		out->len += stale_len;
+		out->dirty = true;
+		status_dirty = true;
+	}
+	jobs_arm();
+	return 0;
+}
+
+/* Worker thread, runs queued jobs */
+static void *worker(void *arg)
+{
+	(void)arg;
+	const uint64_t one = 1;
 
-		memcpy(&u_ctx->last, &now, sizeof(now));
-		for(short w = *u_wd; -1 < w; w = *(++u_wd))
-		{
+	for(;;) {
+		if (sem_wait(&job_sem))
+			continue;
+		for(short w=0; COUNT(widget)>w; ++w) {
 			const Widget *wd = &widget[w];
-			void *w_ctx = widget_ctx[w];
-			char *w_buf = widget_buf[w];
-			(wd->func)(w_buf, wd->buflen, w_ctx, wd->arg);
-		}
+			Job *j = &job[w];
+			int queued = JOB_QUEUED;
 
-		switch(up->type) {
-		case UP_WALLCLOCK:
-			/* next := now + period - ((now - offset) % period) */
-			if (up->arg.wallclock.wait <= 1) {
-				u_ctx->next.tv_sec = now.tv_sec + 1;
-			} else {
-				struct timespec A = {0, 0};
-				A.tv_sec = now.tv_sec - up->arg.wallclock.offset;
-				A.tv_sec %= up->arg.wallclock.wait;
-				A.tv_sec = up->arg.wallclock.wait - A.tv_sec;
-				u_ctx->next.tv_sec = now.tv_sec + A.tv_sec;
-			}
-			u_ctx->next.tv_nsec = 0;
+			if (0 >= wd->deadline
+			|| !atomic_compare_exchange_strong_explicit(&j->state,
+			        &queued, JOB_RUNNING,
+			        memory_order_acquire, memory_order_relaxed))
+				continue;
+
+			int64_t t = clock_ns(CLOCK_MONOTONIC);
+			j->buf[0] = '\0';
+			j->val.n = 0;
+			cur_val = &j->val;
+			job_widget = w;
+			j->rc = (wd->func)(j->buf, wd->buflen, widget_ctx[w], wd->arg);
+			job_widget = -1;
+			cur_val = NULL;
+			j->ns = clock_ns(CLOCK_MONOTONIC) - t;
+			j->val.rc = j->rc;
+			j->val.time_ns = clock_ns(CLOCK_REALTIME);
+			atomic_store_explicit(&j->state, JOB_DONE, memory_order_release);
+			if (0 > write(job_efd, &one, sizeof(one)))
+				ERROR("Can't signal main loop. %s", strerror(errno));
 			break;
-		default:
-			continue;
 		}
 	}
+	return NULL;
+}
 
-	update_status();
-	push_status(status);
+/* Start workers for widgets with a deadline. They are never stopped, a run
+ * may hang forever. */
+static void workers_start(void)
+{
+	sigset_t all, old;
+	int n = 0;
+	pthread_t t;
 
-	clock_gettime(CLOCK_REALTIME, &now);
-	timespec_add(&closest, &now, &default_lag); /* default wait value */
-	for(short u = 0; COUNT(update) > u; ++u) {
-		UpdateCtx *u_ctx = update_ctx[u];
-		if (u_ctx->next.tv_sec < closest.tv_sec
-		|| u_ctx->next.tv_nsec < closest.tv_nsec)
-			memcpy(&closest, &u_ctx->next, sizeof(u_ctx->next));
+	for(short w=0; COUNT(widget)>w; ++w)
+		if (0 < widget[w].deadline)
+			++n;
+	if (WORKERS_MAX < n)
+		n = WORKERS_MAX;
+
+	/* signals are for the main loop only */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for(; 0 < n; --n)
+		if (pthread_create(&t, NULL, worker, NULL)
+		|| pthread_detach(t)) {
+			ERROR("Can't start worker.");
+			die(ERR_PANIC);
+		}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Restore heap order around `sched_heap[i]` */
+static void sched_sift(short i)
+{
+	short u = sched_heap[i];
+	int64_t next = update_ctx[u]->next;
+
+	/* up */
+	while (0 < i) {
+		short p = (i - 1) / 2;
+		if (update_ctx[sched_heap[p]]->next <= next)
+			break;
+		sched_heap[i] = sched_heap[p];
+		update_ctx[sched_heap[i]]->heap_i = i;
+		i = p;
+	}
+	/* down */
+	for(;;) {
+		short c = 2 * i + 1;
+		if (sched_len <= c)
+			break;
+		if (sched_len > c + 1
+		&& update_ctx[sched_heap[c + 1]]->next < update_ctx[sched_heap[c]]->next)
+			++c;
+		if (next <= update_ctx[sched_heap[c]]->next)
+			break;
+		sched_heap[i] = sched_heap[c];
+		update_ctx[sched_heap[i]]->heap_i = i;
+		i = c;
+	}
+	sched_heap[i] = u;
+	update_ctx[u]->heap_i = i;
+}
+
+/* Move update `u` to deadline `next`, negative `next` unschedules it */
+static void sched_set(short u, int64_t next)
+{
+	UpdateCtx *u_ctx = update_ctx[u];
+	short i = u_ctx->heap_i;
+
+	if (0 > next) {
+		if (0 > i)
+			return;
+		u_ctx->heap_i = -1;
+		if (--sched_len == i)
+			return;
+		sched_heap[i] = sched_heap[sched_len];
+		update_ctx[sched_heap[i]]->heap_i = i;
+		sched_sift(i);
+		return;
+	}
+
+	u_ctx->next = next;
+	if (0 > i) {
+		i = sched_len++;
+		sched_heap[i] = u;
+		u_ctx->heap_i = i;
+	}
+	sched_sift(i);
+}
+
+/* Deadline of update `u` after the one started at `rt` (CLOCK_REALTIME)
+ * and `mono` (CLOCK_MONOTONIC), all in ns.
+ * @return -1 - no more updates */
+static int64_t sched_next(short u, int64_t rt, int64_t mono)
+{
+	const Update *up = &update[u];
+
+	switch(up->type) {
+	case UP_ONCE:
+		return -1;
+	case UP_ATLEAST:
+		return clock_ns(CLOCK_MONOTONIC) + up->arg.atleast.wait * 1000000;
+	case UP_ADAPTIVE:
+		return mono + update_ctx[u]->period * 1000000;
+	case UP_WALLCLOCK:
+		;
+		/* next := now + period - ((now - offset) % period) */
+		int64_t wait = (int64_t)up->arg.wallclock.wait * 1000000;
+		int64_t A = (rt - (int64_t)up->arg.wallclock.offset * 1000000) % wait;
+		if (0 > A)
+			A += wait;
+		/* wallclock deadline expressed in CLOCK_MONOTONIC */
+		return mono + wait - A;
+	default:
+		return -1;
 	}
+}
+
+/* Run widgets of update `u`
+ * @return true - output of any widget changed */
+static bool run_update(short u)
+{
+	const Update *up = &update[u];
+	UpdateCtx *u_ctx = update_ctx[u];
+	const short *u_wd = (const short *)update_widgets[u];
+	bool changed = false;
 
 	clock_gettime(CLOCK_REALTIME, &now);
-	{
-		struct timespec diff;
-		timespec_sub(&diff, &closest, &now);
-		if (0 <= diff.tv_sec)
-			nanosleep(&diff, NULL);
+	memcpy(&u_ctx->last, &now, sizeof(now));
+	++u_ctx->wakeups;
+
+	for(short w = *u_wd; -1 < w; w = *(++u_wd))
+		changed |= run_widget(w);
+
+	if (UP_ADAPTIVE == up->type) {
+		long max = up->arg.adaptive.max;
+		if (on_battery)
+			max *= adaptive_battery_stretch;
+
+		if (changed)
+			u_ctx->period = up->arg.adaptive.wait;
+		else if (u_ctx->period < max)
+			u_ctx->period = max / 2 < u_ctx->period ? max : 2 * u_ctx->period;
+		else
+			/* left on battery */
+			u_ctx->period = max;
+	}
+
+	return changed;
+}
+
+/* Run every update whose deadline has come and arm the timer for the
+ * closest one left */
+static void run_due(void)
+{
+#ifdef IO_URING
+	uring_batch(clock_ns(CLOCK_MONOTONIC));
+#endif
+	for(;;) {
+		int64_t rt = clock_ns(CLOCK_REALTIME);
+		/* read after `rt`, so wallclock deadlines never come early */
+		int64_t mono = clock_ns(CLOCK_MONOTONIC);
+
+		if (0 == sched_len || update_ctx[sched_heap[0]]->next > mono)
+			break;
+
+		short u = sched_heap[0];
+		run_update(u);
+		sched_set(u, sched_next(u, rt, mono));
+	}
+#ifdef IO_URING
+	sysattr_batch = 0;
+#endif
+	sched_arm();
+}
+
+/* Arm `sched_tfd` at the closest deadline */
+static void sched_arm(void)
+{
+	struct itimerspec its = {0};
+	if (0 < sched_len) {
+		int64_t next = update_ctx[sched_heap[0]]->next;
+		its.it_value.tv_sec = next / 1000000000;
+		its.it_value.tv_nsec = next % 1000000000;
+	}
+	if (0 > timerfd_settime(sched_tfd, TFD_TIMER_ABSTIME, &its, NULL))
+		ERROR("Can't arm scheduler timer. %s", strerror(errno));
+}
+
+/* Wallclock was set discontinuously, wallclock deadlines are invalid now */
+static void reschedule_all(void)
+{
+	int64_t mono = clock_ns(CLOCK_MONOTONIC);
+
+	for(short u=0; COUNT(update)>u; ++u)
+		if (UP_WALLCLOCK == update[u].type)
+			sched_set(u, mono);
+	clockset_arm();
+}
+
+/* Arm `clockset_tfd` a day ahead */
+static void clockset_arm(void)
+{
+	/* Timer gets cancelled when the clock is set (NTP step, resume from
+	 * suspend), its expiration itself doesn't matter. */
+	struct itimerspec its = {0};
+	its.it_value.tv_sec = clock_ns(CLOCK_REALTIME) / 1000000000 + 86400;
+	if (0 > timerfd_settime(clockset_tfd,
+	                        TFD_TIMER_ABSTIME|TFD_TIMER_CANCEL_ON_SET,
+	                        &its, NULL))
+		ERROR("Can't arm clock timer. %s", strerror(errno));
+}
+
+static int clock_was_set(int fd, uint32_t events, void *data)
+{
+	(void)events;
+	(void)data;
+	uint64_t expirations;
+
+	if (0 <= read(fd, &expirations, sizeof(expirations))) {
+		/* a day has passed with the clock untouched */
+		clockset_arm();
+		return 0;
+	}
+	if (ECANCELED != errno)
+		return 0;
+
+	reschedule_all();
+	run_due();
+	return 0;
+}
+
+static int sched_expired(int fd, uint32_t events, void *data)
+{
+	(void)events;
+	(void)data;
+	uint64_t expirations;
+
+	if (0 > read(fd, &expirations, sizeof(expirations))
+	&& EAGAIN == errno)
+		return 0;
+
+	run_due();
+	return 0;
+}
+
+/* Run callback of `wt`, on behalf of its owner widget or source */
+static void dispatch(Watch *wt, uint32_t events)
+{
+	cur_widget = sysattr_owner = wt->owner;
+	cur_source = sysattr_source = wt->source;
+	if (0 <= wt->owner || 0 <= wt->source)
+		TRACE_CALL(TR_WATCH, wt - watch, events);
+	int rc = (wt->cb)(wt->fd, events, wt->data);
+	cur_widget = sysattr_owner = -1;
+	cur_source = sysattr_source = -1;
+
+	if (0 > rc)
+		unwatch_fd(wt->fd);
+	else if (0 < rc && 0 <= wt->owner && run_widget(wt->owner))
+		adaptive_reset(wt->owner);
+	else if (0 < rc && 0 <= wt->source)
+		run_source(wt->source);
+}
+
+static void loop(void)
+{
+	struct epoll_event ev[EVENTS_MAX];
+	int n;
+
+	n = epoll_wait(epfd, ev, COUNT(ev), -1);
+	if (0 > n) {
+		if (EINTR == errno)
+			return;
+		ERROR("epoll_wait returned error. %s", strerror(errno));
+		die(ERR_PANIC);
 	}
+	++tick;
+
+	for(int i=0; n>i; ++i) {
+		Watch *wt = (Watch *)ev[i].data.ptr;
+		if (0 > wt->fd)
+			/* removed by a previous event */ continue;
+		dispatch(wt, ev[i].events);
+	}
+
+	if (update_status())
+		push_status(status);
+	shm_publish();
+}
+
+/* Create the export of widgets, see `shm.h`. Segment of a previous run is
+ * replaced, readers reopen it. */
+static void shm_start(void)
+{
+	size_t size = sizeof(struct dwmstatus_shm)
+	            + COUNT(widget) * sizeof(struct dwmstatus_shm_widget);
+	struct dwmstatus_shm *m;
+	int fd;
+
+	snprintf(shm_name, sizeof(shm_name), DWMSTATUS_SHM_NAME, (unsigned)getuid());
+	shm_unlink(shm_name);
+	fd = shm_open(shm_name, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC, 0600);
+	if (0 > fd)
+		goto error;
+
+	/* status, then widget texts */
+	size_t status_off = size;
+	size += STATUS_BUFLEN;
+	for(short w=0; COUNT(widget)>w; ++w)
+		size += widget[w].buflen ? widget[w].buflen : 1;
+
+	if (ftruncate(fd, size))
+		goto error;
+	m = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == m)
+		goto error;
+	close(fd);
+
+	m->version = DWMSTATUS_SHM_VERSION;
+	m->size = size;
+	m->pid = getpid();
+	m->nwidgets = COUNT(widget);
+	m->status_off = status_off;
+	size = status_off + STATUS_BUFLEN;
+	for(short w=0; COUNT(widget)>w; ++w) {
+		m->widget[w].text_off = size;
+		size += widget[w].buflen ? widget[w].buflen : 1;
+	}
+	__atomic_store_n(&m->magic, DWMSTATUS_SHM_MAGIC, __ATOMIC_RELEASE);
+	shm = m;
+	shm_dirty = true;
+	return;
+
+error:
+	NOTE("Can't export widgets to shared memory. %s", strerror(errno));
+	if (0 <= fd) {
+		close(fd);
+		shm_unlink(shm_name);
+	}
+}
+
+/* Copy widgets into the export under its seqlock, if any has run */
+static void shm_publish(void)
+{
+	if (!shm || !shm_dirty)
+		return;
+	shm_dirty = false;
+
+	uint32_t seq = shm->seq;
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	for(short w=0; COUNT(widget)>w; ++w) {
+		struct dwmstatus_shm_widget *sw = &shm->widget[w];
+		const WidgetVal *val = &widget_val[w];
+		char *text = (char *)shm + sw->text_off;
+
+		sw->time_ns = val->time_ns;
+		sw->rc = val->rc;
+		sw->flags = job[w].stale ? DWMSTATUS_SHM_STALE : 0;
+		sw->nvalues = val->n;
+		memcpy(sw->value, val->v, sizeof(sw->value));
+		sw->text_len = widget_out[w].len;
+		if (widget_buf[w])
+			memcpy(text, widget_buf[w], sw->text_len);
+		text[sw->text_len] = '\0';
+	}
+	shm->status_len = strlen(status);
+	memcpy((char *)shm + shm->status_off, status, shm->status_len + 1);
+	shm->time_ns = clock_ns(CLOCK_REALTIME);
+
+	__atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
 }
 
-int main(void)
+/* Everything but X and signals */
+static void setup(void)
 {
+	start_ns = clock_ns(CLOCK_MONOTONIC);
+
+	/* main loop initialization */
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (0 > epfd) {
+		ERROR("epoll_create1 returned error. %s", strerror(errno));
+		die(ERR_PANIC);
+	}
+	for(short i=0; COUNT(watch)>i; ++i)
+		watch[i].fd = -1;
+	sched_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	clockset_tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (0 > sched_tfd || 0 > clockset_tfd
+	|| 0 > watch_fd(sched_tfd, EPOLLIN, sched_expired, NULL)
+	|| 0 > watch_fd(clockset_tfd, EPOLLIN, clock_was_set, NULL)) {
+		ERROR("Can't set up timers. %s", strerror(errno));
+		die(ERR_PANIC);
+	}
+	job_efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	job_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (0 > job_efd || 0 > job_tfd || sem_init(&job_sem, 0, 0)
+	|| 0 > watch_fd(job_efd, EPOLLIN, jobs_done, NULL)
+	|| 0 > watch_fd(job_tfd, EPOLLIN, jobs_late, NULL)) {
+		ERROR("Can't set up workers. %s", strerror(errno));
+		die(ERR_PANIC);
+	}
+
+	/* state of everything in one zeroed arena, no allocations after */
+	arena_layout();
+	arena = mmap(NULL, arena_len, PROT_READ|PROT_WRITE,
+	             MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+	if (MAP_FAILED == arena) {
+		arena = NULL;
+		ERROR("Can't map %zu bytes. %s", arena_len, strerror(errno));
+		die(ERR_PANIC);
+	}
+	arena_layout();
+#ifdef ARENA_MLOCK
+	if (0 > mlock(arena, arena_len))
+		NOTE("Can't lock %zu bytes of state in memory. %s",
+		     arena_len, strerror(errno));
+#endif
+
 	/* updates initialization */
-	update_ctx = ecalloc(COUNT(update), sizeof(void *));
 	for(int u=0; COUNT(update)>u; ++u)
 		init_update(u, &update_ctx[u]);
 	/* widgets initialization */
-	widget_buf = ecalloc(COUNT(widget), sizeof(void *));
-	widget_ctx = ecalloc(COUNT(widget), sizeof(void *));
-	for(int w=0; COUNT(widget)>w; ++w)
-		init_widget(w, &widget_buf[w], &widget_ctx[w]);
+#ifdef PROFILE_PERF
+	perf_open();
+#endif
+#ifdef IO_URING
+	uring_setup();
+#endif
+	for(int w=0; COUNT(widget)>w; ++w) {
+		atomic_init(&job[w].state, JOB_IDLE);
+		if (0 < widget[w].deadline && widget[w].src) {
+			ERROR("Widget %d has a deadline, it can't use sources.", w);
+			die(ERR_INVALID_INPUT);
+		}
+	}
 
 	/* status string initialization */
-	status = ecalloc(STATUS_BUFLEN, sizeof(char));
+	compose_status(0);
+}
+
+#ifndef BENCH
+int main(int argc, char *argv[])
+{
+#ifdef TRACE
+	trace_start(argc, argv);
+#else
+	(void)argc;
+	(void)argv;
+#endif
+	setup();
+#ifdef TRACE
+	if (TRACE_REPLAY == trace_mode)
+		trace_replay();
+#endif
 
 #ifndef DEBUG_NO_X11
 	/* X initialization */
@@ -318,17 +1803,33 @@ int main(void)
 	nice(NICE_LVL);
 #endif
 
+	writer_start();
+	workers_start();
+	shm_start();
 	exitnow = 0;
 	setup_signals();
 
+	/* first run of everything, then wait for events */
+	reschedule_all();
+	run_due();
+	update_status();
+	push_status(status);
+	shm_publish();
+
 	for(;;)
 	{
 		loop();
 		if (exitnow) goto sig_exitnow;
+		if (dumpnow) {
+			dumpnow = 0;
+			print_stats(stderr);
+		}
 	}
 
 sig_exitnow:
 	/* Got SIGTERM, exit cleanly */
+	writer_stop();
+	print_stats(stderr);
 	die(ERR_OK);
 }
-
+#endif /* BENCH */
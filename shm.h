@@ -0,0 +1,110 @@
+/* Widgets exported by dwmstatus to POSIX shared memory, for readers on the
+ * same host. The segment is written under a seqlock: readers copy it whole
+ * and retry while `seq` is odd or has changed meanwhile, so a snapshot is
+ * consistent and takes no syscalls.
+ *
+ *	size_t size;
+ *	const struct dwmstatus_shm *m = dwmstatus_shm_open(&size);
+ *	struct dwmstatus_shm *snap = malloc(size);
+ *	if (m && snap && 0 == dwmstatus_shm_read(m, snap, size))
+ *		puts(dwmstatus_shm_text(snap, &snap->widget[0]));
+ *
+ * A new dwmstatus replaces the segment, readers whose `m->pid` is gone or
+ * whose read fails should open it again. */
+#ifndef DWMSTATUS_SHM_H
+#define DWMSTATUS_SHM_H
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DWMSTATUS_SHM_NAME "/dwmstatus-%u"	/* of getuid(2) */
+#define DWMSTATUS_SHM_MAGIC 0x73776d64u		/* "dmws" */
+#define DWMSTATUS_SHM_VERSION 1
+#define DWMSTATUS_SHM_VALUES 4			/* raw values per widget */
+#define DWMSTATUS_SHM_SPINS (1 << 20)		/* reads before giving up */
+
+#define DWMSTATUS_SHM_STALE 1	/* widget missed its deadline, text is older */
+
+struct dwmstatus_shm_widget {
+	int64_t time_ns;	/* CLOCK_REALTIME of the last run, 0 -- none */
+	int32_t rc;		/* result of the last run, <0 -- failed */
+	uint16_t flags;		/* DWMSTATUS_SHM_* */
+	uint16_t nvalues;
+	int64_t value[DWMSTATUS_SHM_VALUES];	/* see `widgets.h` */
+	uint32_t text_off,	/* NUL-terminated, from the segment start */
+		 text_len;
+};
+
+struct dwmstatus_shm {
+	uint32_t magic,		/* set last, once the segment is ready */
+		 version;
+	uint32_t seq;		/* odd while being written */
+	uint32_t size;		/* of the whole segment */
+	int32_t pid;		/* of the writer */
+	uint32_t nwidgets;
+	int64_t time_ns;	/* CLOCK_REALTIME of the last change */
+	uint32_t status_off,	/* status string, as in the root window name */
+		 status_len;
+	struct dwmstatus_shm_widget widget[];
+};
+
+static inline const char *dwmstatus_shm_text(const struct dwmstatus_shm *m,
+                                             const struct dwmstatus_shm_widget *w)
+{
+	return (const char *)m + w->text_off;
+}
+
+/* Map the segment of this user read-only, `*size` gets its size.
+ * @return NULL - failure, check errno */
+static inline const struct dwmstatus_shm *dwmstatus_shm_open(size_t *size)
+{
+	char name[32];
+	struct stat st;
+	void *m;
+	int fd;
+
+	snprintf(name, sizeof(name), DWMSTATUS_SHM_NAME, (unsigned)getuid());
+	fd = shm_open(name, O_RDONLY|O_CLOEXEC, 0);
+	if (0 > fd)
+		return NULL;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(struct dwmstatus_shm)) {
+		close(fd);
+		return NULL;
+	}
+	m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == m)
+		return NULL;
+	*size = st.st_size;
+	return (const struct dwmstatus_shm *)m;
+}
+
+/* Copy a consistent snapshot of `m` into `snap` of `len` bytes.
+ * @return 0 - success
+ * @return -1 - not ready, other version, too small `snap` or the writer
+ *              stopped in the middle of an update */
+static inline int dwmstatus_shm_read(const struct dwmstatus_shm *m, void *snap, size_t len)
+{
+	if (DWMSTATUS_SHM_MAGIC != __atomic_load_n(&m->magic, __ATOMIC_ACQUIRE)
+	|| DWMSTATUS_SHM_VERSION != m->version || len < m->size)
+		return -1;
+
+	for(long spin=0; DWMSTATUS_SHM_SPINS>spin; ++spin) {
+		uint32_t seq = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(snap, m, m->size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq == __atomic_load_n(&m->seq, __ATOMIC_RELAXED))
+			return 0;
+	}
+	return -1;
+}
+
+#endif /* DWMSTATUS_SHM_H */
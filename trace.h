@@ -0,0 +1,354 @@
+/* `make trace`: record and replay of widget inputs.
+ * Included by main.c when built with -DTRACE, libc functions below are
+ * wrapped at link time (see TRACE_WRAP in Makefile).
+ *
+ *   dwmstatus-trace record FILE -- run as usual, log everything widgets read
+ *   dwmstatus-trace replay FILE -- feed the log to the same widgets, no devices
+ *
+ * Only calls made on behalf of a widget or a source are traced: during their
+ * run and in callbacks of descriptors they watch. A trace is a header and
+ * a sequence of records, each followed by `len` bytes the call returned.
+ * Widget runs, source collections and watch events are records too, replay
+ * starts from those and checks that every call matches the next record.
+ * Traces are in host byte order and only replay with the configuration they
+ * were recorded with. */
+
+#include <stddef.h>
+
+#define TRACE_MAGIC "dwmstrc1"
+#define TRACE_ORDER 0x01020304
+
+enum TraceOp {
+	/* markers, `rc` -- tick */
+	TR_WIDGET = 1,
+	TR_SOURCE,
+	TR_WATCH,	/* data: events */
+	/* calls, `rc` -- returned value, data: what was read */
+	TR_OPEN,
+	TR_OPENAT,
+	TR_CLOSE,
+	TR_READ,
+	TR_PREAD,
+	TR_RECV,
+	TR_SEND,
+	TR_SOCKET,
+	TR_BIND,
+	TR_SETSOCKOPT,
+	TR_STATVFS,
+	TR_CLOCK_GETTIME,
+	TR_OPENDIR,
+	TR_READDIR,
+	TR_CLOSEDIR,
+	TR_DIRFD,
+	TR_EPOLL_CTL,
+	TR_FSTAT,
+	TR_WRITE,
+};
+
+typedef struct TraceHdr {
+	char magic[8];
+	uint32_t order;
+	uint16_t widgets,
+		 sources;
+} TraceHdr;
+
+typedef struct TraceRec {
+	int64_t rc;
+	uint32_t len;	/* bytes of data following the record */
+	int16_t who;	/* marker: widget, source or watch index;
+			 * call: widget, or COUNT(widget) + source */
+	uint8_t op;
+	uint8_t err;	/* errno after the call */
+} TraceRec;
+
+static enum { TRACE_OFF, TRACE_RECORD, TRACE_REPLAY } trace_mode;
+static FILE *trace_file;		/* record */
+static char *trace_buf;			/* replay, whole trace */
+static const char *trace_pos,
+		  *trace_end;
+static unsigned long trace_nrec,	/* records replayed */
+		     trace_runs;	/* widget runs and watch events replayed */
+static int64_t trace_start_ns;
+static char trace_dir;			/* replayed `DIR`, never dereferenced */
+static struct dirent trace_dirent;	/* replayed `readdir` entry */
+
+#define TRACING (TRACE_OFF != trace_mode && (0 <= cur_widget || 0 <= cur_source))
+
+static short trace_who(void)
+{
+	return 0 <= cur_widget ? cur_widget : COUNT(widget) + cur_source;
+}
+
+static void trace_stop(void)
+{
+	if (trace_file && fclose(trace_file))
+		ERROR("Can't write trace. %s", strerror(errno));
+	trace_file = NULL;
+}
+
+/* Print results of the replay and exit.
+ * @param why NULL - whole trace replayed; else - why replay has stopped */
+static void trace_finish(const char *why)
+{
+	int64_t ns;
+
+	trace_mode = TRACE_OFF;
+	ns = clock_ns(CLOCK_MONOTONIC) - trace_start_ns;
+	if (why)
+		ERROR("Replay stopped at record %lu: %s", trace_nrec, why);
+	printf("status=%s\n", status);
+	printf("records=%lu runs=%lu replay_ns=%lld ns_per_run=%lld\n",
+	       trace_nrec, trace_runs, (long long)ns,
+	       (long long)(trace_runs ? ns / (int64_t)trace_runs : 0));
+	print_stats(stdout);
+	die(why ? ERR_FAILED : ERR_OK);
+}
+
+static void trace_put(uint8_t op, short who, int64_t rc, const void *data, size_t len)
+{
+	int err = errno;
+	TraceRec r = {.rc = rc, .len = len, .who = who, .op = op, .err = err};
+
+	if (1 != fwrite(&r, sizeof(r), 1, trace_file)
+	|| (0 < len && 1 != fwrite(data, len, 1, trace_file))) {
+		ERROR("Can't write trace, recording stopped. %s", strerror(errno));
+		trace_mode = TRACE_OFF;
+	}
+	errno = err;
+}
+
+/* Take the next record of replay, it has to be `op` of `who`.
+ * @return data of the record */
+static const char *trace_get(TraceRec *r, uint8_t op, short who)
+{
+	const char *data = trace_pos + sizeof(*r);
+
+	if (sizeof(*r) > (size_t)(trace_end - trace_pos))
+		trace_finish("trace ends in the middle of a run");
+	memcpy(r, trace_pos, sizeof(*r));
+	if (r->len > (size_t)(trace_end - data))
+		trace_finish("record is cut");
+	if (op != r->op || who != r->who)
+		trace_finish("code diverged from the trace");
+
+	trace_pos = data + r->len;
+	++trace_nrec;
+	errno = r->err;
+	return data;
+}
+
+/* Replay a call which returns up to `buflen` bytes at `buf` */
+static int64_t trace_in(uint8_t op, void *buf, size_t buflen)
+{
+	TraceRec r;
+	const char *data = trace_get(&r, op, trace_who());
+
+	if (r.len > buflen)
+		trace_finish("data doesn't fit");
+	if (0 < r.len)
+		memcpy(buf, data, r.len);
+	errno = r.err;
+	return r.rc;
+}
+
+/* Marker of a widget run, source collection or watch event */
+static void trace_call(uint8_t op, short who, uint32_t events)
+{
+	TraceRec r;
+
+	if (TRACE_RECORD == trace_mode)
+		trace_put(op, who, tick, &events, TR_WATCH == op ? sizeof(events) : 0);
+	else if (TRACE_REPLAY == trace_mode)
+		trace_get(&r, op, who);
+}
+
+/* Set the mode from command line, before anything else */
+static void trace_start(int argc, char *argv[])
+{
+	TraceHdr hdr = {
+		.magic = TRACE_MAGIC, .order = TRACE_ORDER,
+		.widgets = COUNT(widget), .sources = COUNT(source)
+	};
+	struct stat st;
+
+	if (3 != argc
+	|| (strcmp(argv[1], "record") && strcmp(argv[1], "replay"))) {
+		ERROR("usage: %s record|replay FILE", argv[0]);
+		die(ERR_INVALID_INPUT);
+	}
+	if (!strcmp(argv[1], "record")) {
+		trace_file = fopen(argv[2], "wb");
+		if (!trace_file) {
+			ERROR("Can't open trace %s. %s", argv[2], strerror(errno));
+			die(ERR_FAILED);
+		}
+		if (1 != fwrite(&hdr, sizeof(hdr), 1, trace_file)) {
+			ERROR("Can't write trace %s. %s", argv[2], strerror(errno));
+			die(ERR_FAILED);
+		}
+		atexit(trace_stop);
+		trace_mode = TRACE_RECORD;
+		return;
+	}
+
+	/* replay works on the whole trace in memory */
+	FILE *f = fopen(argv[2], "rb");
+	if (!f || fstat(fileno(f), &st)) {
+		ERROR("Can't open trace %s. %s", argv[2], strerror(errno));
+		die(ERR_FAILED);
+	}
+	trace_buf = calloc(st.st_size + 1, sizeof(char));
+	if (!trace_buf
+	|| (size_t)st.st_size != fread(trace_buf, 1, st.st_size, f)) {
+		ERROR("Can't read trace %s.", argv[2]);
+		die(ERR_FAILED);
+	}
+	fclose(f);
+	if ((size_t)st.st_size < sizeof(hdr)
+	|| memcmp(trace_buf, &hdr, sizeof(hdr))) {
+		ERROR("%s isn't a trace of this configuration on this machine.", argv[2]);
+		die(ERR_INVALID_INPUT);
+	}
+	trace_pos = trace_buf + sizeof(hdr);
+	trace_end = trace_buf + st.st_size;
+	trace_mode = TRACE_REPLAY;
+}
+
+/* Run widgets and callbacks in the order of the trace, doesn't return */
+static void trace_replay(void)
+{
+	TraceRec r;
+	uint32_t events;
+
+	trace_start_ns = clock_ns(CLOCK_MONOTONIC);
+	while (sizeof(r) <= (size_t)(trace_end - trace_pos)) {
+		memcpy(&r, trace_pos, sizeof(r));
+		tick = r.rc;
+		switch(r.op) {
+		case TR_WIDGET:
+			if (0 > r.who || COUNT(widget) <= r.who)
+				trace_finish("unknown widget");
+			run_widget(r.who);
+			break;
+		case TR_WATCH:
+			if (0 > r.who || COUNT(watch) <= r.who
+			|| 0 > watch[r.who].fd || sizeof(events) != r.len)
+				trace_finish("unknown watch");
+			memcpy(&events, trace_pos + sizeof(r), sizeof(events));
+			dispatch(&watch[r.who], events);
+			break;
+		default:
+			trace_finish("call outside of a widget run");
+		}
+		++trace_runs;
+		update_status();
+	}
+	trace_finish(trace_pos == trace_end ? NULL : "record is cut");
+}
+
+/* Wrappers of calls returning `rc` and `len` bytes at `buf`, `size` bytes
+ * at most */
+#define TRACE_WRAP(type, name, op, params, args, buf, size, len) \
+	type __real_##name params; \
+	type __wrap_##name params \
+	{ \
+		if (!TRACING) \
+			return __real_##name args; \
+		if (TRACE_REPLAY == trace_mode) \
+			return (type)trace_in(op, (buf), (size)); \
+		type rc = __real_##name args; \
+		trace_put(op, trace_who(), rc, (buf), 0 <= rc ? (len) : 0); \
+		return rc; \
+	}
+
+TRACE_WRAP(int, close, TR_CLOSE, (int fd), (fd), NULL, 0, 0)
+TRACE_WRAP(ssize_t, read, TR_READ, (int fd, void *buf, size_t n),
+           (fd, buf, n), buf, n, (size_t)rc)
+TRACE_WRAP(ssize_t, pread, TR_PREAD, (int fd, void *buf, size_t n, off_t off),
+           (fd, buf, n, off), buf, n, (size_t)rc)
+TRACE_WRAP(ssize_t, recv, TR_RECV, (int fd, void *buf, size_t n, int flags),
+           (fd, buf, n, flags), buf, n, (size_t)rc)
+TRACE_WRAP(ssize_t, write, TR_WRITE, (int fd, const void *buf, size_t n),
+           (fd, buf, n), NULL, 0, 0)
+TRACE_WRAP(ssize_t, send, TR_SEND, (int fd, const void *buf, size_t n, int flags),
+           (fd, buf, n, flags), NULL, 0, 0)
+TRACE_WRAP(int, socket, TR_SOCKET, (int domain, int type, int proto),
+           (domain, type, proto), NULL, 0, 0)
+TRACE_WRAP(int, bind, TR_BIND, (int fd, const struct sockaddr *sa, socklen_t len),
+           (fd, sa, len), NULL, 0, 0)
+TRACE_WRAP(int, setsockopt, TR_SETSOCKOPT,
+           (int fd, int level, int name, const void *val, socklen_t len),
+           (fd, level, name, val, len), NULL, 0, 0)
+TRACE_WRAP(int, statvfs, TR_STATVFS, (const char *path, struct statvfs *st),
+           (path, st), st, sizeof(*st), sizeof(*st))
+TRACE_WRAP(int, clock_gettime, TR_CLOCK_GETTIME, (clockid_t clk, struct timespec *ts),
+           (clk, ts), ts, sizeof(*ts), sizeof(*ts))
+TRACE_WRAP(int, fstat, TR_FSTAT, (int fd, struct stat *st),
+           (fd, st), st, sizeof(*st), sizeof(*st))
+TRACE_WRAP(int, dirfd, TR_DIRFD, (DIR *d), (d), NULL, 0, 0)
+TRACE_WRAP(int, closedir, TR_CLOSEDIR, (DIR *d), (d), NULL, 0, 0)
+TRACE_WRAP(int, epoll_ctl, TR_EPOLL_CTL,
+           (int ep, int op, int fd, struct epoll_event *ev),
+           (ep, op, fd, ev), NULL, 0, 0)
+
+int __real_open(const char *path, int flags, ...);
+int __wrap_open(const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode;
+
+	va_start(ap, flags);
+	mode = va_arg(ap, mode_t);
+	va_end(ap);
+	if (!TRACING)
+		return __real_open(path, flags, mode);
+	if (TRACE_REPLAY == trace_mode)
+		return trace_in(TR_OPEN, NULL, 0);
+	int rc = __real_open(path, flags, mode);
+	trace_put(TR_OPEN, trace_who(), rc, NULL, 0);
+	return rc;
+}
+
+int __real_openat(int atfd, const char *path, int flags, ...);
+int __wrap_openat(int atfd, const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode;
+
+	va_start(ap, flags);
+	mode = va_arg(ap, mode_t);
+	va_end(ap);
+	if (!TRACING)
+		return __real_openat(atfd, path, flags, mode);
+	if (TRACE_REPLAY == trace_mode)
+		return trace_in(TR_OPENAT, NULL, 0);
+	int rc = __real_openat(atfd, path, flags, mode);
+	trace_put(TR_OPENAT, trace_who(), rc, NULL, 0);
+	return rc;
+}
+
+DIR *__real_opendir(const char *path);
+DIR *__wrap_opendir(const char *path)
+{
+	if (!TRACING)
+		return __real_opendir(path);
+	if (TRACE_REPLAY == trace_mode)
+		return trace_in(TR_OPENDIR, NULL, 0) ? (DIR *)&trace_dir : NULL;
+	DIR *d = __real_opendir(path);
+	trace_put(TR_OPENDIR, trace_who(), NULL != d, NULL, 0);
+	return d;
+}
+
+struct dirent *__real_readdir(DIR *d);
+struct dirent *__wrap_readdir(DIR *d)
+{
+	if (!TRACING)
+		return __real_readdir(d);
+	if (TRACE_REPLAY == trace_mode)
+		return trace_in(TR_READDIR, &trace_dirent, sizeof(trace_dirent))
+		       ? &trace_dirent : NULL;
+	struct dirent *e = __real_readdir(d);
+	trace_put(TR_READDIR, trace_who(), NULL != e, e,
+	          e ? offsetof(struct dirent, d_name) + strlen(e->d_name) + 1 : 0);
+	return e;
+}
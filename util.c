@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <errno.h>
 
 #include "util.h"
@@ -110,3 +111,674 @@ void timespec_add(struct timespec *dest, const struct timespec *A, const struct
 
 	memcpy(dest, &X, sizeof(X));
 }
+
+/* current time of `clk` in nanoseconds */
+int64_t clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+_Thread_local short sysattr_owner = -1,
+		   sysattr_source = -1;
+SysAttr *sysattr_list;
+unsigned long sysattr_gen;
+unsigned long sysattr_batch;
+
+static void sysattr_unlist(SysAttr *a)
+{
+	if (!a->listed)
+		return;
+	for(SysAttr **p = &sysattr_list; *p; p = &(*p)->next)
+		if (a == *p) {
+			*p = a->next;
+			break;
+		}
+	a->listed = 0;
+	++sysattr_gen;
+}
+
+/* @return 0 - success
+ * @return -1 - failure, check errno */
+int sysattr_open(SysAttr *a, int atfd, const char *name, char *buf, size_t buflen)
+{
+	a->atfd = atfd;
+	a->name = name;
+	a->buf = buf;
+	a->buflen = buflen;
+	a->batch = 0;
+	a->fd = openat(atfd, name, O_RDONLY|O_CLOEXEC);
+	if (0 > a->fd)
+		return -1;
+
+	if (!a->listed && (0 <= sysattr_owner || 0 <= sysattr_source)) {
+		a->owner = sysattr_owner;
+		a->source = sysattr_source;
+		a->next = sysattr_list;
+		sysattr_list = a;
+		a->listed = 1;
+	}
+	if (a->listed)
+		++sysattr_gen;
+	return 0;
+}
+
+/* @return length of read data
+ * @return -1 - failure, check errno */
+ssize_t sysattr_read(SysAttr *a)
+{
+	ssize_t n;
+
+	if (0 >= a->fd) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (a->batch && a->batch == sysattr_batch) {
+		a->batch = 0;
+		n = a->res;
+		if (0 > n && -ENODEV != n && -ESTALE != n) {
+			errno = (int)-n;
+			return -1;
+		}
+		if (0 <= n) {
+			a->buf[n] = '\0';
+			return n;
+		}
+		/* device is gone, go the plain way */
+	}
+
+	n = pread(a->fd, a->buf, a->buflen - 1, 0);
+	if (0 > n && (ENODEV == errno || ESTALE == errno)) {
+		/* device is gone, it may be back under the same name */
+		close(a->fd);
+		if (a->listed)
+			++sysattr_gen;
+		a->fd = openat(a->atfd, a->name, O_RDONLY|O_CLOEXEC);
+		if (0 > a->fd)
+			return -1;
+		n = pread(a->fd, a->buf, a->buflen - 1, 0);
+	}
+	if (0 > n)
+		return -1;
+
+	a->buf[n] = '\0';
+	return n;
+}
+
+void sysattr_close(SysAttr *a)
+{
+	if (0 < a->fd)
+		close(a->fd);
+	a->fd = 0;
+	sysattr_unlist(a);
+}
+
+/* Time zones */
+
+static int64_t tz_days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+	y -= m <= 2;
+	int64_t era = (0 <= y ? y : y - 399) / 400;
+	unsigned yoe = (unsigned)(y - era * 400);
+	unsigned doy = (153 * (2 < m ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void tz_civil_from_days(int64_t z, int64_t *y, unsigned *m, unsigned *d)
+{
+	z += 719468;
+	int64_t era = (0 <= z ? z : z - 146096) / 146097;
+	unsigned doe = (unsigned)(z - era * 146097);
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+
+	*d = doy - (153 * mp + 2) / 5 + 1;
+	*m = 10 > mp ? mp + 3 : mp - 9;
+	*y = (int64_t)yoe + era * 400 + (2 >= *m);
+}
+
+static int tz_leap(int64_t y)
+{
+	return 0 == y % 4 && (0 != y % 100 || 0 == y % 400);
+}
+
+/* "hh[:mm[:ss]]" with optional sign
+ * @return end of the parsed string, NULL - failure */
+static const char *tz_rule_time(const char *s, int32_t *sec)
+{
+	int32_t sign = 1, v = 0, scale = 3600;
+
+	if ('+' == *s || '-' == *s)
+		sign = '-' == *s++ ? -1 : 1;
+	for(;;) {
+		int32_t n = 0;
+		if ('0' > *s || '9' < *s)
+			return NULL;
+		while ('0' <= *s && '9' >= *s && 1000 > n)
+			n = n * 10 + (*s++ - '0');
+		v += n * scale;
+		if (':' != *s || 1 == scale)
+			break;
+		++s;
+		scale /= 60;
+	}
+	*sec = sign * v;
+	return s;
+}
+
+/* "abc" or "<+03>" */
+static const char *tz_rule_abbr(const char *s, char *abbr, size_t len)
+{
+	size_t n = 0;
+	char end = '<' == *s ? '>' : '\0';
+
+	if (end)
+		++s;
+	while (*s && (end ? end != *s
+	                  : ('a' <= (*s | 0x20) && 'z' >= (*s | 0x20)))) {
+		if (len - 1 > n)
+			abbr[n++] = *s;
+		++s;
+	}
+	if (end && end != *s++)
+		return NULL;
+	abbr[n] = '\0';
+	return 3 > n ? NULL : s;
+}
+
+static const char *tz_rule_date(const char *s, TzDate *dt)
+{
+	char *end;
+
+	dt->time = 7200;
+	if ('M' == *s) {
+		dt->kind = 'M';
+		dt->m = strtol(s + 1, &end, 10);
+		if ('.' != *end)
+			return NULL;
+		dt->w = strtol(end + 1, &end, 10);
+		if ('.' != *end)
+			return NULL;
+		dt->d = strtol(end + 1, &end, 10);
+		if (1 > dt->m || 12 < dt->m || 1 > dt->w || 5 < dt->w
+		|| 0 > dt->d || 6 < dt->d)
+			return NULL;
+	} else {
+		dt->kind = 'J' == *s ? 'J' : 'N';
+		if ('J' == *s)
+			++s;
+		if ('0' > *s || '9' < *s)
+			return NULL;
+		dt->d = strtol(s, &end, 10);
+		if (365 < dt->d || ('J' == dt->kind && 1 > dt->d))
+			return NULL;
+	}
+	s = end;
+	if ('/' == *s)
+		s = tz_rule_time(s + 1, &dt->time);
+	return s;
+}
+
+/* @return 0 - success, -1 - not a POSIX TZ string */
+static int tz_rule_parse(TzRule *r, const char *s)
+{
+	int32_t off;
+
+	memset(r, 0, sizeof(*r));
+	if (!(s = tz_rule_abbr(s, r->std_abbr, sizeof(r->std_abbr)))
+	|| !(s = tz_rule_time(s, &off)))
+		return -1;
+	/* POSIX offsets are west of UTC */
+	r->std_off = -off;
+	if (!*s)
+		return 0;
+
+	if (!(s = tz_rule_abbr(s, r->dst_abbr, sizeof(r->dst_abbr))))
+		return -1;
+	r->has_dst = 1;
+	r->dst_off = r->std_off + 3600;
+	if (*s && ',' != *s) {
+		if (!(s = tz_rule_time(s, &off)))
+			return -1;
+		r->dst_off = -off;
+	}
+	if (!*s) {
+		/* rules of the US, like glibc without posixrules */
+		s = ",M3.2.0,M11.1.0";
+	}
+	if (',' != *s || !(s = tz_rule_date(s + 1, &r->start))
+	|| ',' != *s || !(s = tz_rule_date(s + 1, &r->end)) || *s)
+		return -1;
+	return 0;
+}
+
+/* UTC time of `dt` in year `y` when `off` is in effect */
+static int64_t tz_rule_when(const TzDate *dt, int64_t y, int32_t off)
+{
+	int64_t days = tz_days_from_civil(y, 1, 1);
+
+	switch(dt->kind) {
+	case 'J':
+		days += dt->d - 1 + (tz_leap(y) && 60 <= dt->d);
+		break;
+	case 'N':
+		days += dt->d;
+		break;
+	default: {
+		static const unsigned char mdays[] = {
+			31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+		};
+		int64_t first = tz_days_from_civil(y, dt->m, 1);
+		int wday = (int)(((first + 4) % 7 + 7) % 7);
+		int mday = 1 + (dt->d - wday + 7) % 7 + (dt->w - 1) * 7;
+		int last = mdays[dt->m - 1] + (2 == dt->m && tz_leap(y));
+		while (mday > last)
+			mday -= 7;
+		days = first + mday - 1;
+	}
+	}
+	return days * 86400 + dt->time - off;
+}
+
+static void tz_rule_apply(const TzRule *r, int64_t t, int32_t *off, int *isdst, const char **abbr)
+{
+	*off = r->std_off;
+	*isdst = 0;
+	*abbr = r->std_abbr;
+	if (!r->has_dst)
+		return;
+
+	int64_t y;
+	unsigned m, d;
+	int64_t lt = t + r->std_off;
+	tz_civil_from_days((0 <= lt ? lt : lt - 86399) / 86400, &y, &m, &d);
+	int64_t start = tz_rule_when(&r->start, y, r->std_off),
+		end = tz_rule_when(&r->end, y, r->dst_off);
+
+	/* southern hemisphere has DST at the turn of the year */
+	if (start < end ? start <= t && end > t : !(end <= t && start > t)) {
+		*off = r->dst_off;
+		*isdst = 1;
+		*abbr = r->dst_abbr;
+	}
+}
+
+static uint32_t tz_be32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static int64_t tz_be64(const unsigned char *p)
+{
+	return (int64_t)((uint64_t)tz_be32(p) << 32 | tz_be32(p + 4));
+}
+
+/* @return 0 - success, -1 - not a TZif file we support */
+static int tz_parse(TzInfo *tz, const unsigned char *p, size_t len)
+{
+	const unsigned char *end = p + len;
+	size_t tsize = 4;
+	uint32_t isutcnt, isstdcnt, leapcnt, timecnt, typecnt, charcnt;
+	size_t body;
+
+	for(;;) {
+		if (44 > end - p || memcmp(p, "TZif", 4))
+			return -1;
+		isutcnt = tz_be32(p + 20);
+		isstdcnt = tz_be32(p + 24);
+		leapcnt = tz_be32(p + 28);
+		timecnt = tz_be32(p + 32);
+		typecnt = tz_be32(p + 36);
+		charcnt = tz_be32(p + 40);
+		if (0x10000 < timecnt || 0x10000 < leapcnt || 0x10000 < isutcnt
+		|| 0x10000 < isstdcnt || 0x10000 < charcnt)
+			return -1;
+		body = timecnt * tsize + timecnt + typecnt * 6 + charcnt
+		     + leapcnt * (tsize + 4) + isstdcnt + isutcnt;
+		if (body > (size_t)(end - p - 44))
+			return -1;
+		/* version 2+ repeats data with 64-bit times after version 1 */
+		if (4 == tsize && '2' <= p[4]) {
+			p += 44 + body;
+			tsize = 8;
+			continue;
+		}
+		break;
+	}
+	/* leap seconds ("right/" zones) aren't supported */
+	if (0 == typecnt || 256 < typecnt || 256 < charcnt || 0 < leapcnt) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	char *data = malloc(timecnt * (sizeof(int64_t) + 1)
+	                    + typecnt * sizeof(TzType) + charcnt + 1);
+	if (!data)
+		return -1;
+	tz->times = (int64_t *)data;
+	tz->types = (TzType *)(data + timecnt * sizeof(int64_t));
+	tz->idx = (unsigned char *)(tz->types + typecnt);
+	tz->abbrs = (char *)(tz->idx + timecnt);
+	tz->ntimes = timecnt;
+	tz->ntypes = typecnt;
+
+	p += 44;
+	for(size_t i=0; timecnt>i; ++i, p += tsize)
+		tz->times[i] = 8 == tsize ? tz_be64(p) : (int32_t)tz_be32(p);
+	for(size_t i=0; timecnt>i; ++i, ++p)
+		if (typecnt <= (tz->idx[i] = *p))
+			goto invalid;
+	for(size_t i=0; typecnt>i; ++i, p += 6) {
+		tz->types[i].off = (int32_t)tz_be32(p);
+		tz->types[i].isdst = p[4];
+		tz->types[i].abbr = p[5];
+		if (charcnt <= p[5])
+			goto invalid;
+	}
+	memcpy(tz->abbrs, p, charcnt);
+	tz->abbrs[charcnt] = '\0';
+	p += charcnt + leapcnt * (tsize + 4) + isstdcnt + isutcnt;
+
+	/* footer: TZ string for times after the last transition */
+	if (8 == tsize && end > p && '\n' == *p) {
+		char rule[64];
+		const unsigned char *nl = memchr(p + 1, '\n', end - p - 1);
+		if (nl && 1 < nl - p && sizeof(rule) > (size_t)(nl - p - 1)) {
+			memcpy(rule, p + 1, nl - p - 1);
+			rule[nl - p - 1] = '\0';
+			tz->has_rule = !tz_rule_parse(&tz->rule, rule);
+		}
+	}
+	return 0;
+
+invalid:
+	free(data);
+	memset(tz, 0, sizeof(*tz));
+	return -1;
+}
+
+/* @return 0 - success
+ * @return -1 - failure, UTC is used, check errno */
+int tz_load(TzInfo *tz, const char *name)
+{
+	char path[PATH_MAX];
+	const char *dir = getenv("TZDIR");
+	unsigned char *buf = NULL;
+	struct stat st;
+	ssize_t n = 0;
+	int fd, rc = -1;
+
+	memset(tz, 0, sizeof(*tz));
+	if (name && ':' == *name)
+		++name;
+	if (!name)
+		name = "/etc/localtime";
+	if ('/' == *name)
+		snprintf(path, sizeof(path), "%s", name);
+	else
+		snprintf(path, sizeof(path), "%s/%s",
+		         dir ? dir : "/usr/share/zoneinfo", name);
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (0 > fd)
+		goto rule;
+	if (!fstat(fd, &st) && 0 < st.st_size && (1 << 20) > st.st_size
+	&& (buf = malloc(st.st_size)))
+		while (st.st_size > n) {
+			ssize_t r = read(fd, buf + n, st.st_size - n);
+			if (0 >= r)
+				break;
+			n += r;
+		}
+	close(fd);
+	if (buf && st.st_size == n && (rc = tz_parse(tz, buf, n))
+	&& ENOTSUP != errno)
+		errno = EINVAL;
+	free(buf);
+	if (!rc)
+		return 0;
+
+rule:
+	if ('/' != *name && !tz_rule_parse(&tz->rule, name)) {
+		tz->has_rule = 1;
+		return 0;
+	}
+	memset(tz, 0, sizeof(*tz));
+	strcpy(tz->rule.std_abbr, "UTC");
+	tz->has_rule = 1;
+	return -1;
+}
+
+void tz_localtime(const TzInfo *tz, int64_t t, struct tm *tm)
+{
+	int32_t off = 0;
+	int isdst = 0;
+	const char *abbr = "UTC";
+
+	if (tz->has_rule && (0 == tz->ntimes || tz->times[tz->ntimes - 1] <= t))
+		tz_rule_apply(&tz->rule, t, &off, &isdst, &abbr);
+	else if (0 < tz->ntypes) {
+		/* type 0 is in effect before the first transition */
+		size_t lo = 0, hi = tz->ntimes;
+		const TzType *type = &tz->types[0];
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			if (tz->times[mid] <= t)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (0 < lo)
+			type = &tz->types[tz->idx[lo - 1]];
+		off = type->off;
+		isdst = type->isdst;
+		abbr = tz->abbrs + type->abbr;
+	}
+
+	int64_t lt = t + off;
+	int64_t days = (0 <= lt ? lt : lt - 86399) / 86400;
+	int64_t secs = lt - days * 86400;
+	int64_t y;
+	unsigned m, d;
+
+	tz_civil_from_days(days, &y, &m, &d);
+	tm->tm_year = (int)(y - 1900);
+	tm->tm_mon = m - 1;
+	tm->tm_mday = d;
+	tm->tm_hour = secs / 3600;
+	tm->tm_min = secs / 60 % 60;
+	tm->tm_sec = secs % 60;
+	tm->tm_wday = (int)(((days + 4) % 7 + 7) % 7);
+	tm->tm_yday = (int)(days - tz_days_from_civil(y, 1, 1));
+	tm->tm_isdst = isdst;
+	tm->tm_gmtoff = off;
+	tm->tm_zone = abbr;
+}
+
+/* Formatting and parsing */
+
+ssize_t fmt_str(char *buf, size_t len, const char *s)
+{
+	size_t n = strlen(s);
+
+	if (len <= n)
+		return -1;
+	memcpy(buf, s, n + 1);
+	return (ssize_t)n;
+}
+
+/* `neg` sign and `v` */
+static ssize_t fmt_uint(char *buf, size_t len, int neg, uint64_t v)
+{
+	char tmp[24];
+	size_t n = sizeof(tmp);
+
+	do
+		tmp[--n] = '0' + v % 10;
+	while (v /= 10);
+	if (neg)
+		tmp[--n] = '-';
+	if (len <= sizeof(tmp) - n)
+		return -1;
+	memcpy(buf, tmp + n, sizeof(tmp) - n);
+	buf[sizeof(tmp) - n] = '\0';
+	return (ssize_t)(sizeof(tmp) - n);
+}
+
+ssize_t fmt_int(char *buf, size_t len, int64_t v)
+{
+	return fmt_uint(buf, len, 0 > v, 0 > v ? -(uint64_t)v : (uint64_t)v);
+}
+
+static ssize_t fmt_ufixed(char *buf, size_t len, int neg, uint64_t n, uint64_t d, int prec)
+{
+	uint64_t q = n / d,
+		 r = n % d;
+	char frac[9];
+	int nonzero = 0 != q;
+	ssize_t w;
+
+	if (0 > prec)
+		prec = 0;
+	if ((int)sizeof(frac) < prec)
+		prec = sizeof(frac);
+	/* long division, `r` < `d` <= 10^18 keeps `r * 10` in range */
+	for(int i=0; prec>i; ++i) {
+		r *= 10;
+		frac[i] = r / d;
+		r %= d;
+		nonzero |= 0 != frac[i];
+	}
+	/* round half up */
+	if (r >= d - r) {
+		int i = prec - 1;
+		for(; 0 <= i && 9 == frac[i]; --i)
+			frac[i] = 0;
+		if (0 <= i)
+			++frac[i];
+		else
+			++q;
+		nonzero = 1;
+	}
+
+	w = fmt_uint(buf, len, neg && nonzero, q);
+	if (0 > w || (0 < prec && len <= (size_t)w + 1 + prec))
+		return -1;
+	if (0 < prec) {
+		buf[w++] = '.';
+		for(int i=0; prec>i; ++i)
+			buf[w++] = '0' + frac[i];
+		buf[w] = '\0';
+	}
+	return w;
+}
+
+ssize_t fmt_fixed(char *buf, size_t len, int64_t num, int64_t den, int prec)
+{
+	if (0 >= den) {
+		errno = EDOM;
+		return -1;
+	}
+	return fmt_ufixed(buf, len, 0 > num,
+	                  0 > num ? -(uint64_t)num : (uint64_t)num,
+	                  (uint64_t)den, prec);
+}
+
+ssize_t fmt_size(char *buf, size_t len, uint64_t bytes, int prec)
+{
+	static const char unit[] = "BKMGTPE";
+	uint64_t den = 1;
+	int u = 0;
+	ssize_t w;
+
+	while (1000 <= bytes / den && unit[u + 1]) {
+		den *= 1024;
+		++u;
+	}
+	if (0 == u)
+		w = fmt_uint(buf, len, 0, bytes);
+	else
+		w = fmt_ufixed(buf, len, 0, bytes, den, prec);
+	if (0 > w || len <= (size_t)w + 1)
+		return -1;
+	if (0 < u) {
+		buf[w++] = unit[u];
+		buf[w] = '\0';
+	}
+	return w;
+}
+
+const char *parse_int(const char *s, int64_t *v)
+{
+	uint64_t n = 0;
+	int neg = 0;
+	const char *digits;
+
+	while (' ' == *s || '\t' == *s)
+		++s;
+	if ('-' == *s || '+' == *s)
+		neg = '-' == *s++;
+	for(digits = s; '0' <= *s && '9' >= *s; ++s)
+		if (INT64_MAX / 10 >= n)
+			n = n * 10 + (*s - '0');
+		else
+			n = (uint64_t)INT64_MAX + 1;
+	if (digits == s)
+		return NULL;
+
+	if (neg)
+		*v = INT64_MAX < n ? INT64_MIN : -(int64_t)n;
+	else
+		*v = INT64_MAX < n ? INT64_MAX : (int64_t)n;
+	return s;
+}
+
+const char *parse_uint(const char *s, const char *end, uint64_t *v)
+{
+	uint64_t n = 0;
+	const char *digits;
+
+	while (end > s && (' ' == *s || '\t' == *s))
+		++s;
+	digits = s;
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	static const uint64_t pow10[] = {
+		1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+	};
+	while (8 <= end - s) {
+		uint64_t x;
+		memcpy(&x, s, sizeof(x));
+		/* digits become 0-9, anything else has high nibble set or
+		 * low nibble above 9 (carries only spoil bytes after it) */
+		x ^= 0x3030303030303030;
+		uint64_t nondigit = (x | (x + 0x0606060606060606)) & 0xF0F0F0F0F0F0F0F0;
+		int len = nondigit ? __builtin_ctzll(nondigit) / 8 : 8;
+		if (0 == len)
+			break;
+		/* first digit is in the lowest byte, pad with leading zeros */
+		x <<= 8 * (8 - len);
+		x = ((x & 0x0F0F0F0F0F0F0F0F) * 2561) >> 8;
+		x = ((x & 0x00FF00FF00FF00FF) * 6553601) >> 16;
+		x = ((x & 0x0000FFFF0000FFFF) * 42949672960001) >> 32;
+		n = n * pow10[len] + x;
+		s += len;
+		if (8 > len)
+			goto done;
+	}
+#endif
+	for(; end > s && '0' <= *s && '9' >= *s; ++s)
+		n = n * 10 + (*s - '0');
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+done:
+#endif
+	if (digits == s)
+		return NULL;
+	*v = n;
+	return s;
+}
@@ -27,4 +27,116 @@ void timespec_sub(struct timespec *dest, const struct timespec *A, const struct
 /* A plus B (both must be positive) */
 void timespec_add(struct timespec *dest, const struct timespec *A, const struct timespec *B);
 
+/* sysfs attribute kept open and re-read with pread(2) */
+typedef struct SysAttr {
+	int fd;		/* 0 -- not opened */
+	int atfd;
+	const char *name;
+	char *buf;	/* owned by the caller */
+	size_t buflen;
+	/* batched reads, see `sysattr_list` */
+	struct SysAttr *next;
+	int listed;
+	short owner,	/* `sysattr_owner` when opened */
+	      source;
+	unsigned long batch;	/* `buf` holds result of this batch */
+	ssize_t res;		/* length read, -errno on failure */
+} SysAttr;
+
+/* Attributes opened while `sysattr_owner` or `sysattr_source` isn't -1 are
+ * kept in `sysattr_list` so their reads can be done ahead in a batch. They
+ * are tagged with both values. Tags are per thread, the list and the rest
+ * are touched only by the thread which sets the tags. */
+extern _Thread_local short sysattr_owner,
+			   sysattr_source;
+extern SysAttr *sysattr_list;
+extern unsigned long sysattr_gen;	/* changes when the list or its fds do */
+extern unsigned long sysattr_batch;	/* current batch, 0 -- none */
+
+/* @return 0 - success
+ * @return -1 - failure, check errno */
+int sysattr_open(SysAttr *a, int atfd, const char *name, char *buf, size_t buflen);
+
+/* Read attribute into `a->buf` (NUL-terminated), reopen it if the device
+ * has gone away meanwhile. Takes the result of `sysattr_batch` if there is
+ * one.
+ * @return length of read data
+ * @return -1 - failure, check errno */
+ssize_t sysattr_read(SysAttr *a);
+
+void sysattr_close(SysAttr *a);
+
+/* current time of `clk` in nanoseconds */
+int64_t clock_ns(clockid_t clk);
+
+/* POSIX TZ date of a DST change: Jn, n or Mm.w.d */
+typedef struct TzDate {
+	char kind;	/* 'J', 'N' or 'M' */
+	short m, w, d;	/* 'J', 'N': day in `d` */
+	int32_t time;	/* local seconds since midnight */
+} TzDate;
+
+/* POSIX TZ rule, "std offset [dst [offset] [,start[/time],end[/time]]]" */
+typedef struct TzRule {
+	int32_t std_off,	/* seconds east of UTC */
+		dst_off;
+	char std_abbr[12],
+	     dst_abbr[12];
+	int has_dst;
+	TzDate start, end;
+} TzRule;
+
+typedef struct TzType {
+	int32_t off;		/* seconds east of UTC */
+	unsigned char isdst,
+		      abbr;	/* index in `TzInfo.abbrs` */
+} TzType;
+
+/* Time zone from a TZif file, see tzfile(5) */
+typedef struct TzInfo {
+	size_t ntimes,
+	       ntypes;
+	int64_t *times;		/* transitions, ascending */
+	unsigned char *idx;	/* type since each transition */
+	TzType *types;
+	char *abbrs;
+	int has_rule;		/* `rule` applies after the last transition */
+	TzRule rule;
+} TzInfo;
+
+/* Load zone `name` like TZ environment variable does: NULL - /etc/localtime;
+ * absolute path; path under TZDIR; POSIX TZ string. Falls back to UTC.
+ * @return 0 - success
+ * @return -1 - failure, UTC is used, check errno */
+int tz_load(TzInfo *tz, const char *name);
+
+/* localtime_r(3) in `tz`, sets tm_gmtoff and tm_zone as well */
+void tz_localtime(const TzInfo *tz, int64_t t, struct tm *tm);
+
+/* Formatting into the caller's buffer of `len` bytes, NUL included. No
+ * locale, no allocation.
+ * @return length of the written string
+ * @return -1 - doesn't fit, `buf` is left unterminated */
+ssize_t fmt_str(char *buf, size_t len, const char *s);
+ssize_t fmt_int(char *buf, size_t len, int64_t v);
+
+/* `num`/`den` rounded to `prec` (0-9) decimals, `den` is 1..10^18 */
+ssize_t fmt_fixed(char *buf, size_t len, int64_t num, int64_t den, int prec);
+
+/* Bytes with B, K, M, G, T, P or E unit of 1024, the unit grows when value
+ * reaches 1000. Bytes are whole, larger units have `prec` decimals. */
+ssize_t fmt_size(char *buf, size_t len, uint64_t bytes, int prec);
+
+/* Parse decimal integer after optional blanks and sign, like sysfs values
+ * are. Saturates on overflow.
+ * @return end of the number
+ * @return NULL - not a number */
+const char *parse_int(const char *s, int64_t *v);
+
+/* Parse unsigned decimal integer after optional blanks, 8 digits at a time,
+ * reading nothing at or after `end`. Doesn't check overflow.
+ * @return end of the number
+ * @return NULL - not a number */
+const char *parse_uint(const char *s, const char *end, uint64_t *v);
+
 #endif /* UTIL_H */
@@ -1,17 +1,102 @@
-/* functions in format `ssize_t (char *restrict, size_t, void *, const Arg)` */
+/* widgets in format `ssize_t (char *restrict, size_t, void *, const Arg)`
+ * Raw values they export by `widget_value`, see `shm.h`:
+ *   getbattery     -- energy now, energy max (µWh or µAh), power (µW or µA),
+ *                     index in `status_match`
+ *   getdiskusage   -- bytes
+ *   getnetwork     -- rx bytes, tx bytes, link flags
+ *   gettemperature -- millidegrees C
+ *   getcpu         -- busy percent of all cores
+ *   getmemory      -- bytes, in the order shown
+ *   getpressure    -- avg10 of cpu, memory, io in hundredths of percent
+ *   getdiskio      -- read bytes/s, written bytes/s, IOPS, await µs */
 ssize_t mktimes(char *restrict, size_t, void *, const Arg);
 ssize_t getbattery(char *restrict, size_t, void *, const Arg);
 ssize_t getdiskusage(char *restrict, size_t, void *, const Arg);
 ssize_t getnetwork(char *restrict, size_t, void *, const Arg);
 ssize_t gettemperature(char *restrict, size_t, void *, const Arg);
+ssize_t getcpu(char *restrict, size_t, void *, const Arg);
+ssize_t getmemory(char *restrict, size_t, void *, const Arg);
+ssize_t getsegment(char *restrict, size_t, void *, const Arg);
+ssize_t getpressure(char *restrict, size_t, void *, const Arg);
+ssize_t getdiskio(char *restrict, size_t, void *, const Arg);
+
+/* sources in format `int (void *, const Arg)` */
+int src_readfile(void *, const Arg);
+int src_rtnl(void *, const Arg);
+int src_segments(void *, const Arg);
+
+/* source-argument structures */
+struct src_readfile_arg {
+	const char *path;
+	size_t buflen;	/* has to match `struct src_readfile_ctx` size */
+};
+/* Unix socket other programs set named segments through, one line
+ * "<name> <text>" per segment, empty text clears it */
+struct src_segments_arg {
+	const char *path;	/* relative: to $XDG_RUNTIME_DIR, or /tmp */
+	long interval;		/* ms, at least that long between re-runs of the
+				 * widgets and between reads from one client */
+};
+
+/* source-context structures */
+struct src_readfile_ctx {
+	SysAttr attr;
+	size_t len;
+	char buf[];
+};
+#define SRC_READFILE_CTX_SIZE(buflen) (sizeof(struct src_readfile_ctx) + (buflen))
+struct src_rtnl_link {
+	const char *if_name;
+	int ifindex;	/* 0 -- link not found */
+	unsigned int flags;
+	bool has_addr,
+	     has_addr6,
+	     has_stats;
+	struct in_addr addr;
+	struct in6_addr addr6;
+	uint64_t rx,
+		 tx;
+};
+struct src_rtnl_ctx {
+	int fd_query,	/* request/reply */
+	    fd_event;	/* link and address change groups */
+	bool resync;	/* links and addresses have to be asked for */
+	short nlinks;
+	struct src_rtnl_link link[8];
+};
+#define SEGMENTS_MAX 16
+#define SEGMENTS_CLIENTS 8
+struct src_segments_seg {
+	char name[16];		/* "" -- free */
+	char text[64];
+};
+struct src_segments_client {
+	int fd;			/* 0 -- free */
+	bool paused;		/* over its rate, not read until `next` */
+	int64_t next;		/* CLOCK_MONOTONIC of the next read, ns */
+	size_t len;
+	char buf[256];		/* incomplete line */
+};
+struct src_segments_ctx {
+	int fd,			/* listening socket, 0 -- not open */
+	    fd_timer;		/* CLOCK_MONOTONIC, rate limit */
+	const struct src_segments_arg *arg;
+	int64_t next;		/* earliest re-run of the widgets, ns */
+	int64_t armed;		/* `fd_timer` deadline, 0 -- none */
+	bool pending;		/* segments changed since the last re-run */
+	struct src_segments_client client[SEGMENTS_CLIENTS];
+	struct src_segments_seg seg[SEGMENTS_MAX];
+};
 
 /* widget-argument structures */
 struct mktimes_arg {
 	const char *fmt;
-	const char *tzname;
+	const char *tzname;	/* NULL: /etc/localtime; else: like TZ variable */
 };
 struct getbattery_arg {
 	const char *dir;
+	const char *uevent;	/* NULL: read attributes below from their own files;
+				 * else: read them at once from this file */
 	const char *present,
 		   *energy_max,
 		   *energy_now,
@@ -21,58 +106,921 @@ struct getbattery_arg {
 	const char *(*status_match);
 	const char *(*status_output);
 	const char *status_undef;
+	bool listen;	/* re-run on power_supply uevents from kernel */
 };
 struct getdiskusage_arg {
 	int mode; /* 0: file size; 1: fs free; 2: fs used/total; */
 	const char *path;
 	const char *name; /* NULL: don't print name; else: use name */
 };
+/* rx and tx rates shown by `getnetwork`, bytes per second. Each takes up
+ * to 14 bytes, percentiles twice that, a sparkline 3 bytes per sample. */
+enum {
+	GETNETWORK_NOW   = 1 << 0,	/* since the previous sample */
+	GETNETWORK_EWMA  = 1 << 1,	/* moving average over `ewma` ms */
+	GETNETWORK_PCT   = 1 << 2,	/* median/95th percentile of the history */
+	GETNETWORK_SPARK = 1 << 3,	/* sparkline of rx + tx, `spark` samples */
+};
 struct getnetwork_arg {
 	bool view_rates;
 	const char *if_name;
 	const char *vi_name;
+	unsigned char rates;	/* GETNETWORK_*, 0: GETNETWORK_NOW */
+	long ewma;		/* ms, 0: GETNETWORK_EWMA_MS */
+	short spark;		/* samples, 0: 8 */
 };
 struct gettemperature_arg {
 	const char *dir;
 	const char *sensor;
 };
+#define GETMEMORY_KEYS 8
+/* uses `src_readfile` of /proc/meminfo */
+struct getmemory_arg {
+	int mode; /* 0: available; 1: used/total; 2: `keys`; */
+	const char *name; /* NULL: don't print name; else: use name */
+	const char *(*keys);	/* /proc/meminfo keys, NULL-terminated */
+	const char *(*labels);	/* NULL: no labels; else: one per key */
+};
+/* resources of `getpressure` */
+enum {
+	GETPRESSURE_CPU    = 1 << 0,
+	GETPRESSURE_MEMORY = 1 << 1,
+	GETPRESSURE_IO     = 1 << 2,
+};
+struct getpressure_arg {
+	const char *name; /* NULL: don't print name; else: use name */
+	const char *cgroup;	/* NULL: whole system; else: cgroup v2 directory */
+	unsigned char res;	/* GETPRESSURE_*, 0: all */
+	bool full;		/* "full" line instead of "some" */
+	/* NULL: no trigger; else: PSI trigger, e.g. "some 150000 1000000" --
+	 * re-run once tasks stall 150 ms within 1 s. Unprivileged users need
+	 * a window of whole 2 s. */
+	const char *trigger;
+};
+/* shown by `getdiskio`, of all its devices together */
+enum {
+	GETDISKIO_BYTES = 1 << 0,	/* read/written bytes per second */
+	GETDISKIO_IOPS  = 1 << 1,	/* reads/writes per second */
+	GETDISKIO_AWAIT = 1 << 2,	/* mean time of an I/O, queue included */
+	GETDISKIO_QUEUE = 1 << 3,	/* mean I/Os in flight */
+};
+#define GETDISKIO_DEVICES 8
+/* uses `src_readfile` of /proc/diskstats, big enough for all of its lines
+ * up to the last wanted device, about 150 bytes per line */
+struct getdiskio_arg {
+	const char *name; /* NULL: don't print name; else: use name */
+	const char *(*devices);	/* NULL-terminated, e.g. "nvme0n1", "dm-0" */
+	unsigned char show;	/* GETDISKIO_*, 0: GETDISKIO_BYTES */
+};
+/* uses `src_segments` */
+struct getsegment_arg {
+	const char *name;
+};
+/* uses `src_readfile` of /proc/stat */
+struct getcpu_arg {
+	int mode; /* 0: total; 1: busiest `top` cores; 2: bar of every core; */
+	const char *name; /* NULL: don't print name; else: use name */
+	short first,	/* modes 1, 2: cores `first` .. `first` + `ncpu` - 1 */
+	      ncpu;	/* has to match `GETCPU_CTX_SIZE` */
+	short top;
+};
 
 /* widget-context structures */
+#define MKTIMES_PIECES 16
+struct mktimes_piece {
+	char spec[8];		/* one conversion, "" -- literal text */
+	unsigned char dep,	/* MKTIMES_* fields the output depends on */
+		      len;
+	char out[22];
+};
+struct mktimes_ctx {
+	bool ready;	/* zone loaded, format split */
+	bool whole;	/* format didn't split, strftime it all */
+	TzInfo tz;
+	struct tm last;
+	short npieces;
+	struct mktimes_piece piece[MKTIMES_PIECES];
+};
+struct getcpu_core {
+	uint64_t busy,		/* jiffies at the last run */
+		 total;
+	unsigned char pct;	/* busy since the previous run */
+	bool online;
+};
+struct getcpu_ctx {
+	struct getcpu_core all,
+			   core[];	/* flat, `getcpu_arg.ncpu` of them */
+};
+#define GETCPU_CTX_SIZE(ncpu) (sizeof(struct getcpu_ctx) + (ncpu) * sizeof(struct getcpu_core))
 struct gettemperature_ctx {
 	int fd_hwmon;
+	SysAttr sensor;
+	char rbuf[24];
+};
+#define GETNETWORK_HIST 64		/* samples kept, about 2 minutes */
+#define GETNETWORK_MIN_NS 100000000	/* shorter samples are skipped */
+#define GETNETWORK_EWMA_MS 10000
+#define GETNETWORK_BUCKETS (1 + 4 * 48)	/* quarter-octave rates up to 2^48 B/s */
+struct getnetwork_sample {
+	uint64_t delta[2];	/* rx, tx bytes */
+	int64_t t,		/* CLOCK_MONOTONIC at the end, ns */
+		dt;		/* length */
 };
 struct getnetwork_ctx {
-	uint64_t last_rx,
-		 last_tx;
-	struct timespec last;
+	const struct src_rtnl_link *link;
+	uint64_t last[2];	/* rx, tx counters at `last_t` */
+	int64_t last_t;		/* 0 -- no sample yet */
+	uint64_t ewma[2];	/* bytes per second */
+	unsigned short head,	/* next slot of `hist` */
+		       n;
+	struct getnetwork_sample hist[GETNETWORK_HIST];
+	/* rates of `hist` by `getnetwork_bucket`, for percentiles */
+	unsigned char bucket[2][GETNETWORK_BUCKETS];
+};
+/* /proc/diskstats counters, see Documentation/admin-guide/iostats.rst */
+struct getdiskio_stat {
+	uint64_t ios[2],	/* reads, writes completed */
+		 sectors[2],
+		 ticks,		/* ms spent by completed I/Os */
+		 queue;		/* ms spent by all I/Os in flight */
+};
+struct getdiskio_ctx {
+	size_t off[GETDISKIO_DEVICES];	/* line of each device in the last read */
+	struct getdiskio_stat last;
+	int64_t last_t;			/* 0 -- no sample yet */
+	/* since the previous sample */
+	uint64_t bytes[2],		/* per second */
+		 iops[2];
+	int64_t await_us,
+		queue;			/* in hundredths */
+};
+struct getpressure_res {
+	SysAttr attr;
+	int fd_trig;	/* 0 -- not set up, -1 -- none */
+	char rbuf[160];
+};
+struct getpressure_ctx {
+	int fd_dir;
+	struct getpressure_res res[3];	/* cpu, memory, io */
 };
 struct getbattery_ctx {
 	int fd_dir;
+	SysAttr present,
+		energy_max,
+		energy_now,
+		power_now,
+		status;
+	char rbuf[5][32];
+	SysAttr uevent;
+	char ubuf[1024];
+	int fd_kobj;	/* NETLINK_KOBJECT_UEVENT */
+};
+struct getbattery_val {
+	int present;
+	long energy_max,
+	     energy_now,
+	     power_now;
+	const char *status;	/* not NUL-terminated */
+	size_t status_len;
 };
 
 /* code */
 
+/* sources */
+
+int src_readfile(void *ctx, const Arg arg)
+{
+	struct src_readfile_arg *s = (struct src_readfile_arg *)arg.v;
+	struct src_readfile_ctx *c = (struct src_readfile_ctx *)ctx;
+
+	if (0 >= c->attr.fd
+	&& 0 > sysattr_open(&c->attr, AT_FDCWD, s->path, c->buf, s->buflen))
+		goto error;
+
+	ssize_t n = sysattr_read(&c->attr);
+	if (0 > n)
+		goto error;
+	c->len = (size_t)n;
+	return 0;
+
+error:
+	c->len = 0;
+	return -1;
+}
+
+/* Link of the rtnetlink source, added on the first request */
+static struct src_rtnl_link *src_rtnl_link(struct src_rtnl_ctx *r, const char *if_name)
+{
+	for(short i=0; r->nlinks>i; ++i)
+		if (!strcmp(if_name, r->link[i].if_name))
+			return &r->link[i];
+	if (COUNT(r->link) <= r->nlinks)
+		return NULL;
+
+	struct src_rtnl_link *l = &r->link[r->nlinks++];
+	memset(l, 0, sizeof(*l));
+	l->if_name = if_name;
+	r->resync = true;
+	return l;
+}
+
+static void src_rtnl_forget(struct src_rtnl_link *l)
+{
+	l->ifindex = 0;
+	l->has_addr = l->has_addr6 = l->has_stats = false;
+}
+
+/* Apply rtnetlink message to the links state.
+ * @return 1 - state of a link changed
+ * @return 0 - message is about something else */
+static int src_rtnl_nlmsg(struct src_rtnl_ctx *r, const struct nlmsghdr *nh)
+{
+	int changed = 0;
+
+	switch(nh->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		;
+		const struct ifinfomsg *ifi = NLMSG_DATA(nh);
+		const struct rtattr *rta = IFLA_RTA(ifi);
+		int rtalen = IFLA_PAYLOAD(nh);
+		const char *name = NULL;
+		const struct rtattr *stats = NULL;
+
+		for(; RTA_OK(rta, rtalen); rta = RTA_NEXT(rta, rtalen)) {
+			if (IFLA_IFNAME == rta->rta_type)
+				name = RTA_DATA(rta);
+			else if (IFLA_STATS64 == rta->rta_type)
+				stats = rta;
+		}
+
+		for(short i=0; r->nlinks>i; ++i) {
+			struct src_rtnl_link *l = &r->link[i];
+			bool same_name = name && !strcmp(name, l->if_name);
+
+			if (ifi->ifi_index != l->ifindex && !same_name)
+				continue;
+			changed = 1;
+			if (RTM_DELLINK == nh->nlmsg_type || (name && !same_name)) {
+				/* removed or renamed */
+				src_rtnl_forget(l);
+				continue;
+			}
+			if (ifi->ifi_index != l->ifindex) {
+				/* re-created, addresses of the old index are stale;
+				 * a link found by name gets them in the same sync */
+				if (l->ifindex)
+					r->resync = true;
+				src_rtnl_forget(l);
+				l->ifindex = ifi->ifi_index;
+			}
+			l->flags = ifi->ifi_flags;
+			if (stats && RTA_PAYLOAD(stats) >= sizeof(struct rtnl_link_stats64)) {
+				struct rtnl_link_stats64 st;
+				memcpy(&st, RTA_DATA(stats), sizeof(st));
+				l->rx = st.rx_bytes;
+				l->tx = st.tx_bytes;
+				l->has_stats = true;
+			}
+		}
+		return changed;
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		;
+		const struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+		const struct rtattr *local = NULL,
+		                    *address = NULL;
+		struct src_rtnl_link *l = NULL;
+		rta = IFA_RTA(ifa);
+		rtalen = IFA_PAYLOAD(nh);
+
+		for(short i=0; r->nlinks>i; ++i)
+			if ((int)ifa->ifa_index == r->link[i].ifindex)
+				l = &r->link[i];
+		if (!l)
+			return 0;
+		for(; RTA_OK(rta, rtalen); rta = RTA_NEXT(rta, rtalen)) {
+			if (IFA_LOCAL == rta->rta_type)
+				local = rta;
+			else if (IFA_ADDRESS == rta->rta_type)
+				address = rta;
+		}
+		/* IFA_LOCAL is own address on point-to-point links */
+		if (local)
+			address = local;
+		if (!address)
+			return 0;
+
+		bool add = RTM_NEWADDR == nh->nlmsg_type;
+		if (AF_INET == ifa->ifa_family
+		&& RTA_PAYLOAD(address) >= sizeof(l->addr)) {
+			if (add && !l->has_addr) {
+				memcpy(&l->addr, RTA_DATA(address), sizeof(l->addr));
+				l->has_addr = true;
+			} else if (!add && l->has_addr
+			&& !memcmp(&l->addr, RTA_DATA(address), sizeof(l->addr))) {
+				/* there may be another one */
+				l->has_addr = false;
+				r->resync = true;
+			}
+			return 1;
+		}
+		if (AF_INET6 == ifa->ifa_family
+		&& RT_SCOPE_UNIVERSE == ifa->ifa_scope
+		&& RTA_PAYLOAD(address) >= sizeof(l->addr6)) {
+			if (add && !l->has_addr6) {
+				memcpy(&l->addr6, RTA_DATA(address), sizeof(l->addr6));
+				l->has_addr6 = true;
+			} else if (!add && l->has_addr6
+			&& !memcmp(&l->addr6, RTA_DATA(address), sizeof(l->addr6))) {
+				l->has_addr6 = false;
+				r->resync = true;
+			}
+			return 1;
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/* Receive rtnetlink messages from `fd` and apply them, until NLMSG_DONE if
+ * `until_done` is set, or until the socket is drained (with MSG_DONTWAIT).
+ * @return 1 - state of a link changed
+ * @return 0 - nothing changed
+ * @return -1 - failure, check errno */
+static int src_rtnl_recv(struct src_rtnl_ctx *r, int fd, int flags, bool until_done)
+{
+	_Alignas(struct nlmsghdr) char rbuf[8192];
+	int changed = 0;
+
+	for(;;) {
+		ssize_t n = recv(fd, rbuf, sizeof(rbuf), flags);
+		if (0 > n) {
+			if (EAGAIN == errno || EWOULDBLOCK == errno)
+				return changed;
+			if (ENOBUFS == errno) {
+				/* events were lost */
+				r->resync = true;
+				return 1;
+			}
+			return -1;
+		}
+
+		const struct nlmsghdr *nh = (const struct nlmsghdr *)rbuf;
+		for(; NLMSG_OK(nh, (size_t)n); nh = NLMSG_NEXT(nh, n)) {
+			if (NLMSG_DONE == nh->nlmsg_type)
+				return changed;
+			if (NLMSG_ERROR == nh->nlmsg_type) {
+				const struct nlmsgerr *err = NLMSG_DATA(nh);
+				if (0 == err->error)
+					return changed;
+				errno = -err->error;
+				return -1;
+			}
+			changed |= src_rtnl_nlmsg(r, nh);
+		}
+		if (!until_done)
+			return changed;
+	}
+}
+
+/* Ask kernel for the link (by index, or by name if index is unknown) */
+static int src_rtnl_getlink(struct src_rtnl_ctx *r, struct src_rtnl_link *l)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ifinfomsg ifi;
+		char attrs[RTA_SPACE(IFNAMSIZ)];
+	} req = {0};
+
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+	req.nh.nlmsg_type = RTM_GETLINK;
+	req.nh.nlmsg_flags = NLM_F_REQUEST;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = l->ifindex;
+	if (0 == l->ifindex) {
+		struct rtattr *rta = (struct rtattr *)((char *)&req + NLMSG_ALIGN(req.nh.nlmsg_len));
+		size_t len = strlen(l->if_name) + 1;
+		if (IFNAMSIZ < len) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		rta->rta_type = IFLA_IFNAME;
+		rta->rta_len = RTA_LENGTH(len);
+		memcpy(RTA_DATA(rta), l->if_name, len);
+		req.nh.nlmsg_len = NLMSG_ALIGN(req.nh.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+	}
+
+	if (0 > send(r->fd_query, &req, req.nh.nlmsg_len, 0))
+		return -1;
+	if (0 > src_rtnl_recv(r, r->fd_query, 0, false)) {
+		if (ENODEV != errno)
+			return -1;
+		/* no such link */
+		src_rtnl_forget(l);
+	}
+	return 0;
+}
+
+/* Ask kernel for addresses of link `ifindex` */
+static int src_rtnl_getaddr(struct src_rtnl_ctx *r, int ifindex)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ifaddrmsg ifa;
+	} req = {0};
+
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+	req.nh.nlmsg_type = RTM_GETADDR;
+	req.nh.nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+	req.ifa.ifa_family = AF_UNSPEC;
+	/* filtered by kernel with NETLINK_GET_STRICT_CHK, by us otherwise */
+	req.ifa.ifa_index = ifindex;
+
+	if (0 > send(r->fd_query, &req, req.nh.nlmsg_len, 0))
+		return -1;
+	return 0 > src_rtnl_recv(r, r->fd_query, 0, true) ? -1 : 0;
+}
+
+/* Look up every link and its addresses again. Known links are asked for
+ * by index, by name only once the index is gone. */
+static int src_rtnl_sync(struct src_rtnl_ctx *r)
+{
+	r->resync = false;
+	for(short i=0; r->nlinks>i; ++i) {
+		struct src_rtnl_link *l = &r->link[i];
+		int known = l->ifindex;
+
+		l->has_addr = l->has_addr6 = false;
+		if (0 > src_rtnl_getlink(r, l)
+		|| (known && !l->ifindex && 0 > src_rtnl_getlink(r, l)))
+			return -1;
+	}
+	/* one filtered dump per link, not every address of the host */
+	for(short i=0; r->nlinks>i; ++i)
+		if (r->link[i].ifindex
+		&& 0 > src_rtnl_getaddr(r, r->link[i].ifindex))
+			return -1;
+	return 0;
+}
+
+/* Link and address changes pushed by kernel */
+static int src_rtnl_event(int fd, uint32_t events, void *data)
+{
+	(void)events;
+	struct src_rtnl_ctx *r = (struct src_rtnl_ctx *)data;
+
+	int rc = src_rtnl_recv(r, fd, MSG_DONTWAIT, true);
+	return 0 > rc ? 0 : rc;
+}
+
+/* Open rtnetlink sockets: one for queries and one for change events */
+static int src_rtnl_open(struct src_rtnl_ctx *r)
+{
+	struct sockaddr_nl sa = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK|RTMGRP_IPV4_IFADDR|RTMGRP_IPV6_IFADDR
+	};
+	int one = 1;
+
+	r->fd_query = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (0 > r->fd_query)
+		goto error;
+	setsockopt(r->fd_query, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one));
+
+	r->fd_event = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC|SOCK_NONBLOCK, NETLINK_ROUTE);
+	if (0 > r->fd_event
+	|| 0 > bind(r->fd_event, (struct sockaddr *)&sa, sizeof(sa))
+	|| 0 > watch_fd(r->fd_event, EPOLLIN, src_rtnl_event, r)) {
+		if (0 <= r->fd_event)
+			close(r->fd_event);
+		close(r->fd_query);
+		goto error;
+	}
+
+	r->resync = true;
+	return 0;
+
+error:
+	r->fd_query = r->fd_event = 0;
+	return -1;
+}
+
+/* Link state and addresses are pushed by kernel, only counters have to be
+ * asked for, once per tick for all widgets. */
+int src_rtnl(void *ctx, const Arg arg)
+{
+	(void)arg;
+	struct src_rtnl_ctx *r = (struct src_rtnl_ctx *)ctx;
+
+	if (0 >= r->fd_query && 0 > src_rtnl_open(r))
+		return -1;
+
+	if (r->resync)
+		return src_rtnl_sync(r);
+
+	for(short i=0; r->nlinks>i; ++i)
+		if (r->link[i].ifindex
+		&& 0 > src_rtnl_getlink(r, &r->link[i]))
+			return -1;
+	return 0;
+}
+
+/* Fire `fd_timer` at `t` unless it fires sooner */
+static void src_segments_arm(struct src_segments_ctx *c, int64_t t)
+{
+	struct itimerspec its = {0};
+
+	if (c->armed && c->armed <= t)
+		return;
+	its.it_value.tv_sec = t / 1000000000;
+	its.it_value.tv_nsec = t % 1000000000;
+	if (0 == timerfd_settime(c->fd_timer, TFD_TIMER_ABSTIME, &its, NULL))
+		c->armed = t;
+}
+
+/* @return 1 - re-run the widgets now, 0 - not yet or nothing changed */
+static int src_segments_due(struct src_segments_ctx *c, int64_t now)
+{
+	if (!c->pending)
+		return 0;
+	if (now < c->next) {
+		src_segments_arm(c, c->next);
+		return 0;
+	}
+	c->pending = false;
+	c->next = now + c->arg->interval * 1000000;
+	return 1;
+}
+
+/* Apply line "<name> <text>" */
+static void src_segments_set(struct src_segments_ctx *c, char *line, size_t len)
+{
+	struct src_segments_seg *seg = NULL;
+	char *text = memchr(line, ' ', len);
+	size_t name_len = text ? (size_t)(text - line) : len;
+
+	if (0 == name_len || sizeof(seg->name) <= name_len)
+		return;
+	if (text) {
+		++text;
+		len -= text - line;
+	} else {
+		text = line + len;
+		len = 0;
+	}
+	if (sizeof(seg->text) <= len)
+		len = sizeof(seg->text) - 1;
+	/* status is a single line */
+	for(size_t i=0; len>i; ++i)
+		if (' ' > (unsigned char)text[i])
+			text[i] = ' ';
+
+	for(short i=0; SEGMENTS_MAX>i; ++i) {
+		struct src_segments_seg *g = &c->seg[i];
+		if (!strncmp(g->name, line, name_len) && '\0' == g->name[name_len]) {
+			seg = g;
+			break;
+		}
+		if (!seg && '\0' == g->name[0])
+			seg = g;
+	}
+	if (!seg || (!len && '\0' == seg->name[0]))
+		return;
+	if (!strncmp(seg->text, text, len) && '\0' == seg->text[len]
+	&& '\0' != seg->name[0])
+		return;
+
+	memcpy(seg->name, line, name_len);
+	seg->name[name_len] = '\0';
+	memcpy(seg->text, text, len);
+	seg->text[len] = '\0';
+	if (!len)
+		seg->name[0] = '\0';
+	c->pending = true;
+}
+
+static void src_segments_drop(struct src_segments_client *cl)
+{
+	close(cl->fd);
+	cl->fd = 0;
+}
+
+/* Lines from a client. One read per `interval` each: a client writing
+ * faster gets paused, and blocks once its socket buffer is full. */
+static int src_segments_read(int fd, uint32_t events, void *data)
+{
+	(void)events;
+	struct src_segments_ctx *c = (struct src_segments_ctx *)data;
+	struct src_segments_client *cl = NULL;
+	int64_t now = clock_ns(CLOCK_MONOTONIC);
+	ssize_t n;
+
+	for(short i=0; SEGMENTS_CLIENTS>i; ++i)
+		if (fd == c->client[i].fd)
+			cl = &c->client[i];
+	if (!cl)
+		return -1;
+
+	if (now < cl->next) {
+		cl->paused = true;
+		src_segments_arm(c, cl->next);
+		return -1;
+	}
+	n = read(fd, cl->buf + cl->len, sizeof(cl->buf) - cl->len);
+	if (0 > n && (EAGAIN == errno || EINTR == errno))
+		return 0;
+	if (0 >= n) {
+		unwatch_fd(fd);
+		src_segments_drop(cl);
+		return src_segments_due(c, now);
+	}
+	cl->len += n;
+	cl->next = now + c->arg->interval * 1000000;
+
+	char *line = cl->buf, *nl;
+	while ((nl = memchr(line, '\n', cl->buf + cl->len - line))) {
+		size_t len = nl - line;
+		if (0 < len && '\r' == line[len - 1])
+			--len;
+		src_segments_set(c, line, len);
+		line = nl + 1;
+	}
+	cl->len -= line - cl->buf;
+	memmove(cl->buf, line, cl->len);
+	/* too long line is dropped */
+	if (sizeof(cl->buf) == cl->len)
+		cl->len = 0;
+
+	return src_segments_due(c, now);
+}
+
+static int src_segments_accept(int fd, uint32_t events, void *data)
+{
+	(void)events;
+	struct src_segments_ctx *c = (struct src_segments_ctx *)data;
+	int cfd;
+
+	while (0 <= (cfd = accept(fd, NULL, NULL))) {
+		struct src_segments_client *cl = NULL;
+		for(short i=0; SEGMENTS_CLIENTS>i && !cl; ++i)
+			if (0 >= c->client[i].fd)
+				cl = &c->client[i];
+		if (!cl
+		|| 0 > fcntl(cfd, F_SETFD, FD_CLOEXEC)
+		|| 0 > fcntl(cfd, F_SETFL, O_NONBLOCK)
+		|| 0 > watch_fd(cfd, EPOLLIN, src_segments_read, c)) {
+			close(cfd);
+			continue;
+		}
+		memset(cl, 0, sizeof(*cl));
+		cl->fd = cfd;
+	}
+	return 0;
+}
+
+/* Rate limit is over: resume paused clients, re-run the widgets */
+static int src_segments_timer(int fd, uint32_t events, void *data)
+{
+	(void)events;
+	struct src_segments_ctx *c = (struct src_segments_ctx *)data;
+	uint64_t expirations;
+	int64_t now = clock_ns(CLOCK_MONOTONIC);
+
+	if (0 > read(fd, &expirations, sizeof(expirations)) && EAGAIN == errno)
+		return 0;
+	c->armed = 0;
+
+	for(short i=0; SEGMENTS_CLIENTS>i; ++i) {
+		struct src_segments_client *cl = &c->client[i];
+		if (0 >= cl->fd || !cl->paused)
+			continue;
+		if (now < cl->next) {
+			src_segments_arm(c, cl->next);
+			continue;
+		}
+		cl->paused = false;
+		if (0 > watch_fd(cl->fd, EPOLLIN, src_segments_read, c))
+			src_segments_drop(cl);
+	}
+	return src_segments_due(c, now);
+}
+
+/* Segments come through the socket, this only opens it */
+int src_segments(void *ctx, const Arg arg)
+{
+	struct src_segments_arg *s = (struct src_segments_arg *)arg.v;
+	struct src_segments_ctx *c = (struct src_segments_ctx *)ctx;
+	struct sockaddr_un sa = {.sun_family = AF_UNIX};
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	int n;
+	mode_t mask;
+
+	if (0 < c->fd)
+		return 0;
+
+	c->arg = s;
+	if ('/' == s->path[0])
+		n = snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", s->path);
+	else
+		n = snprintf(sa.sun_path, sizeof(sa.sun_path), "%s/%s",
+		             dir ? dir : "/tmp", s->path);
+	if (0 > n || sizeof(sa.sun_path) <= (size_t)n)
+		goto error;
+
+	c->fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	c->fd_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (0 > c->fd || 0 > c->fd_timer)
+		goto reset;
+	/* socket of a previous run */
+	unlink(sa.sun_path);
+	/* owner only */
+	mask = umask(0077);
+	n = bind(c->fd, (struct sockaddr *)&sa, sizeof(sa));
+	umask(mask);
+	if (0 > n
+	|| 0 > listen(c->fd, SEGMENTS_CLIENTS)
+	|| 0 > watch_fd(c->fd, EPOLLIN, src_segments_accept, c))
+		goto reset;
+	if (0 > watch_fd(c->fd_timer, EPOLLIN, src_segments_timer, c)) {
+		unwatch_fd(c->fd);
+		goto reset;
+	}
+	return 0;
+
+reset:
+	if (0 < c->fd)
+		close(c->fd);
+	if (0 < c->fd_timer)
+		close(c->fd_timer);
+	c->fd = c->fd_timer = 0;
+error:
+	return -1;
+}
+
+/* widgets */
+
+/* bars of eight levels */
+static const char widget_level[][4] = {
+	"\u2581", "\u2582", "\u2583", "\u2584",
+	"\u2585", "\u2586", "\u2587", "\u2588"
+};
+
+/* `count` per second of `ns`, without overflow for any 64-bit count */
+static uint64_t widget_rate(uint64_t count, int64_t ns)
+{
+	uint64_t us = (uint64_t)ns / 1000;
+
+	if (0 == us)
+		return 0;
+	return count / us * 1000000 + count % us * 1000000 / us;
+}
+
+/* fields of `struct tm` a conversion depends on */
+enum {
+	MKTIMES_SEC  = 1 << 0,
+	MKTIMES_MIN  = 1 << 1,
+	MKTIMES_HOUR = 1 << 2,
+	MKTIMES_DAY  = 1 << 3,
+	MKTIMES_ZONE = 1 << 4,
+	MKTIMES_ALL  = (1 << 5) - 1
+};
+
+static unsigned char mktimes_dep(char conv)
+{
+	switch(conv) {
+	case 'S':
+		return MKTIMES_SEC;
+	case 'M':
+		return MKTIMES_MIN;
+	case 'H': case 'I': case 'k': case 'l': case 'p': case 'P':
+		return MKTIMES_HOUR;
+	case 'R':
+		return MKTIMES_HOUR|MKTIMES_MIN;
+	case 'a': case 'A': case 'b': case 'B': case 'h': case 'd': case 'e':
+	case 'm': case 'y': case 'Y': case 'C': case 'g': case 'G': case 'j':
+	case 'u': case 'w': case 'U': case 'V': case 'W': case 'D': case 'F':
+	case 'x':
+		return MKTIMES_DAY;
+	case 'z': case 'Z':
+		return MKTIMES_ZONE;
+	default:
+		/* %T, %c, %s, ... */
+		return MKTIMES_ALL;
+	}
+}
+
+/* Split format into literal text and single conversions, which are
+ * re-rendered only when fields they depend on change.
+ * @return 0 - success, -1 - format has too many pieces */
+static int mktimes_split(struct mktimes_ctx *c, const char *fmt)
+{
+	struct mktimes_piece *pc = NULL;
+
+	c->npieces = 0;
+	while (*fmt) {
+		const char *spec = fmt;
+		char conv = '\0';
+
+		if ('%' == *fmt) {
+			/* flags, width, E and O modifiers */
+			++fmt;
+			while (*fmt && strchr("_-0^#", *fmt))
+				++fmt;
+			while ('0' <= *fmt && '9' >= *fmt)
+				++fmt;
+			if ('E' == *fmt || 'O' == *fmt)
+				++fmt;
+			if (!(conv = *fmt))
+				return -1;
+			++fmt;
+		}
+		if (conv && !strchr("%nt", conv)) {
+			if (MKTIMES_PIECES <= c->npieces
+			|| sizeof(pc->spec) <= (size_t)(fmt - spec))
+				return -1;
+			pc = &c->piece[c->npieces++];
+			memcpy(pc->spec, spec, fmt - spec);
+			pc->spec[fmt - spec] = '\0';
+			pc->dep = mktimes_dep(conv);
+			pc = NULL;
+			continue;
+		}
+
+		/* literal text, appended to the previous literal */
+		if (!pc || sizeof(pc->out) - 1 <= pc->len) {
+			if (MKTIMES_PIECES <= c->npieces)
+				return -1;
+			pc = &c->piece[c->npieces++];
+			pc->spec[0] = '\0';
+			pc->dep = 0;
+			pc->len = 0;
+		}
+		pc->out[pc->len++] = 'n' == conv ? '\n' : 't' == conv ? '\t'
+		                   : conv ? '%' : *fmt++;
+		pc->out[pc->len] = '\0';
+	}
+	return 0;
+}
+
 ssize_t mktimes(char *restrict buf, size_t buflen, void *ctx, const Arg arg)
 {
-	(void)ctx;
+	struct mktimes_ctx *c = (struct mktimes_ctx *)ctx;
 	struct mktimes_arg *s = (struct mktimes_arg *)arg.v;
 
 	struct timespec ts;
 	struct tm tm;
+	unsigned char changed = MKTIMES_ALL;
+	size_t ws = 0;
 
-	/* If ct->tzname == NULL, leave TZ undefined and use system localtime.
-	 */
-	unsetenv("TZ");
-	if (s->tzname != NULL)
-		setenv("TZ", s->tzname, 1);
-	tzset();
+	if (!c->ready) {
+		/* tzname == NULL: system localtime */
+		if (0 > tz_load(&c->tz, s->tzname))
+			ERROR("Can't load time zone %s, using UTC. %s",
+			      s->tzname ? s->tzname : "/etc/localtime",
+			      strerror(errno));
+		c->whole = 0 > mktimes_split(c, s->fmt);
+		c->ready = true;
+		c->last.tm_year = INT_MIN;
+	}
 
 	clock_gettime(CLOCK_REALTIME, &ts);
-	localtime_r(&ts.tv_sec, &tm);
+	tz_localtime(&c->tz, ts.tv_sec, &tm);
 
-	size_t ws = strftime(buf, buflen, s->fmt, &tm);
-	if (0 >= ws)
-		goto error;
+	if (c->whole) {
+		ws = strftime(buf, buflen, s->fmt, &tm);
+		if (0 >= ws)
+			goto error;
+		return (ssize_t)ws;
+	}
+
+	if (INT_MIN != c->last.tm_year)
+		changed = (c->last.tm_sec != tm.tm_sec ? MKTIMES_SEC : 0)
+		        | (c->last.tm_min != tm.tm_min ? MKTIMES_MIN : 0)
+		        | (c->last.tm_hour != tm.tm_hour ? MKTIMES_HOUR : 0)
+		        | (c->last.tm_yday != tm.tm_yday
+		        || c->last.tm_year != tm.tm_year ? MKTIMES_DAY : 0)
+		        | (c->last.tm_gmtoff != tm.tm_gmtoff
+		        || c->last.tm_isdst != tm.tm_isdst ? MKTIMES_ZONE : 0);
+	c->last = tm;
+
+	for(short i=0; c->npieces>i; ++i) {
+		struct mktimes_piece *pc = &c->piece[i];
+		if (pc->dep & changed) {
+			pc->len = strftime(pc->out, sizeof(pc->out), pc->spec, &tm);
+			if (0 == pc->len) {
+				/* empty or didn't fit, don't split the format anymore */
+				c->whole = true;
+				return mktimes(buf, buflen, ctx, arg);
+			}
+		}
+		if (buflen - 1 - ws < pc->len)
+			goto error;
+		memcpy(buf + ws, pc->out, pc->len);
+		ws += pc->len;
+	}
+	buf[ws] = '\0';
 
 	return (ssize_t)ws;
 
@@ -80,108 +1028,248 @@ error:
 	return -1;
 }
 
-ssize_t getbattery(char *restrict buf, size_t buflen, void *ctx, const Arg arg)
+/* Close battery attributes, they get reopened on the next run */
+static void getbattery_reset(struct getbattery_ctx *c)
 {
-	struct getbattery_arg *s = (struct getbattery_arg *)arg.v;
-	struct getbattery_ctx *c = (struct getbattery_ctx *)ctx;
+	sysattr_close(&c->present);
+	sysattr_close(&c->energy_max);
+	sysattr_close(&c->energy_now);
+	sysattr_close(&c->power_now);
+	sysattr_close(&c->status);
+	sysattr_close(&c->uevent);
+	if (0 < c->fd_dir)
+		close(c->fd_dir);
+	c->fd_dir = 0;
+}
 
-	short status_index;
-	long energy_max = -1,
-	     energy_now = -1,
-	     power_now = -1;
+/* Parse decimal attribute value, -1 -- not a number */
+static long getbattery_long(const char *str)
+{
+	int64_t v;
+	return parse_int(str, &v) ? (long)v : -1;
+}
 
-	/* Open battery directory if it wasn't */
-	if (c->fd_dir <= 0) {
-		c->fd_dir = open(s->dir, O_RDONLY|O_DIRECTORY);
-		if (0 > c->fd_dir) goto error;
-	}
+/* Read every battery attribute from its own file.
+ * @return 0 - success
+ * @return -1 - failure, attributes have to be reopened */
+static int getbattery_files(struct getbattery_ctx *c, const struct getbattery_arg *s,
+                            struct getbattery_val *v)
+{
+	if (0 >= c->present.fd
+	&& (0 > sysattr_open(&c->present, c->fd_dir, s->present,
+	                     c->rbuf[0], COUNT(c->rbuf[0]))
+	 || 0 > sysattr_open(&c->energy_max, c->fd_dir, s->energy_max,
+	                     c->rbuf[1], COUNT(c->rbuf[1]))
+	 || 0 > sysattr_open(&c->energy_now, c->fd_dir, s->energy_now,
+	                     c->rbuf[2], COUNT(c->rbuf[2]))
+	 || 0 > sysattr_open(&c->power_now, c->fd_dir, s->power_now,
+	                     c->rbuf[3], COUNT(c->rbuf[3]))
+	 || 0 > sysattr_open(&c->status, c->fd_dir, s->status,
+	                     c->rbuf[4], COUNT(c->rbuf[4]))))
+		return -1;
 
 	/* BAT: present */
-	{
-		char rbuf;
-		int fd = openat(c->fd_dir, s->present, O_RDONLY);
-		if (0 > fd) goto error;
+	if (0 > sysattr_read(&c->present))
+		return -1;
+	v->present = c->present.buf[0] == '1';
+	if (!v->present)
+		return 0;
+	/* BAT: energy max capacity, available now and current power consumption */
+	if (0 > sysattr_read(&c->energy_max)
+	|| 0 > sysattr_read(&c->energy_now)
+	|| 0 > sysattr_read(&c->power_now))
+		return -1;
+	v->energy_max = getbattery_long(c->energy_max.buf);
+	v->energy_now = getbattery_long(c->energy_now.buf);
+	v->power_now = getbattery_long(c->power_now.buf);
+	/* BAT: current status of the battery */
+	if (0 > sysattr_read(&c->status))
+		return -1;
+	v->status = c->status.buf;
+	v->status_len = strlen(c->status.buf);
+	return 0;
+}
 
-		read(fd, &rbuf, 1);
-		close(fd);
-		if (rbuf != '1') {
-			sprintf(buf, "no battery");
-			return 11;
+/* Read battery attributes at once from `POWER_SUPPLY_<NAME>=<value>` lines
+ * of the uevent file, <NAME> being attribute file name in upper case.
+ * @return 0 - success
+ * @return -1 - failure, attributes have to be reopened */
+static int getbattery_uevent(struct getbattery_ctx *c, const struct getbattery_arg *s,
+                             struct getbattery_val *v)
+{
+	const char *key[] = {
+		s->present, s->energy_max, s->energy_now, s->power_now, s->status
+	};
+	const unsigned int all = (1u << COUNT(key)) - 1;
+	unsigned int found = 0;
+	const char *p, *nl;
+
+	if (0 >= c->uevent.fd
+	&& 0 > sysattr_open(&c->uevent, c->fd_dir, s->uevent,
+	                    c->ubuf, COUNT(c->ubuf)))
+		return -1;
+	if (0 > sysattr_read(&c->uevent))
+		return -1;
+
+	v->present = 1;
+	for(p = c->uevent.buf; found != all && (nl = strchr(p, '\n')); p = nl + 1) {
+		static const char prefix[] = "POWER_SUPPLY_";
+		if (strncmp(p, prefix, COUNT(prefix) - 1))
+			continue;
+		p += COUNT(prefix) - 1;
+
+		const char *eq = memchr(p, '=', nl - p);
+		if (!eq)
+			continue;
+		size_t klen = eq - p;
+
+		short k;
+		for(k=0; COUNT(key)>k; ++k)
+			if (!(found & 1u << k)
+			&& klen == strlen(key[k])
+			&& !strncasecmp(p, key[k], klen))
+				break;
+		if (COUNT(key) == k)
+			continue;
+		found |= 1u << k;
+
+		const char *val = eq + 1;
+		switch(k) {
+		case 0: v->present = *val == '1'; break;
+		case 1: v->energy_max = getbattery_long(val); break;
+		case 2: v->energy_now = getbattery_long(val); break;
+		case 3: v->power_now = getbattery_long(val); break;
+		case 4:
+			/* with '\n', as in the attribute file */
+			v->status = val;
+			v->status_len = nl + 1 - val;
+			break;
 		}
 	}
-	/* BAT: energy max capacity */
-	{
-		char rbuf[32] = {0};
-		int fd = openat(c->fd_dir, s->energy_max, O_RDONLY);
-		if (0 > fd) goto error;
+	return 0;
+}
 
-		read(fd, rbuf, COUNT(rbuf));
-		close(fd);
-		if (rbuf[COUNT(rbuf)-1] != '\0'
-		|| 0 >= sscanf(rbuf, "%ld", &energy_max))
-			goto error;
-	}
-	/* BAT: energy available now */
-	{
-		char rbuf[32] = {0};
-		int fd = openat(c->fd_dir, s->energy_now, O_RDONLY);
-		if (0 > fd) goto error;
+/* Kernel announced a device change, re-run if it is a power supply */
+static int getbattery_event(int fd, uint32_t events, void *data)
+{
+	(void)events;
+	(void)data;
+	char rbuf[2048];
+	int rerun = 0;
+	ssize_t n;
 
-		read(fd, rbuf, COUNT(rbuf));
-		close(fd);
-		if (rbuf[COUNT(rbuf)-1] != '\0'
-		|| 0 >= sscanf(rbuf, "%ld", &energy_now))
-			goto error;
+	/* `<action>@<devpath>\0` followed by `<KEY>=<value>\0` pairs */
+	while (0 < (n = recv(fd, rbuf, sizeof(rbuf) - 1, MSG_DONTWAIT))) {
+		rbuf[n] = '\0';
+		for(const char *p = rbuf; rbuf + n > p; p += strlen(p) + 1)
+			if (!strcmp(p, "SUBSYSTEM=power_supply")) {
+				rerun = 1;
+				break;
+			}
 	}
-	/* BAT: current power consumption */
-	{
-		char rbuf[32] = {0};
-		int fd = openat(c->fd_dir, s->power_now, O_RDONLY);
-		if (0 > fd) goto error;
+	return rerun;
+}
 
-		read(fd, rbuf, COUNT(rbuf));
-		close(fd);
+/* Listen to kernel uevents, fd stays open for the process lifetime */
+static void getbattery_listen(struct getbattery_ctx *c)
+{
+	struct sockaddr_nl sa = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1	/* kernel events, not the ones relayed by udev */
+	};
 
-		if (rbuf[COUNT(rbuf)-1] != '\0'
-		|| 0 >= sscanf(rbuf, "%ld", &power_now))
-			goto error;
+	c->fd_kobj = socket(AF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK,
+	                    NETLINK_KOBJECT_UEVENT);
+	if (0 > c->fd_kobj)
+		return;
+	if (0 > bind(c->fd_kobj, (struct sockaddr *)&sa, sizeof(sa))
+	|| 0 > watch_fd(c->fd_kobj, EPOLLIN, getbattery_event, c)) {
+		ERROR("Can't listen to uevents. %s", strerror(errno));
+		close(c->fd_kobj);
+		c->fd_kobj = -1;
 	}
-	/* BAT: current status of the battery */
-	{
-		char rbuf[32] = {0};
-		int fd = openat(c->fd_dir, s->status, O_RDONLY);
-		if (0 > fd) goto error;
+}
 
-		read(fd, rbuf, COUNT(rbuf));
-		close(fd);
-		if (rbuf[COUNT(rbuf)-1] != '\0') goto error;
+ssize_t getbattery(char *restrict buf, size_t buflen, void *ctx, const Arg arg)
+{
+	struct getbattery_arg *s = (struct getbattery_arg *)arg.v;
+	struct getbattery_ctx *c = (struct getbattery_ctx *)ctx;
+
+	short status_index;
+	struct getbattery_val v = {
+		.present = 0,
+		.energy_max = -1,
+		.energy_now = -1,
+		.power_now = -1,
+		.status = "",
+		.status_len = 0
+	};
+
+	/* Plug/unplug is pushed by kernel, polling is only a fallback */
+	if (s->listen && 0 == c->fd_kobj)
+		getbattery_listen(c);
 
-		for (status_index=0; s->status_match_count > status_index; ++status_index)
-			if (!strcmp(rbuf, s->status_match[status_index])) break;
-		if (status_index == s->status_match_count)
-			status_index = -1;
+	/* Open battery directory if it wasn't */
+	if (c->fd_dir <= 0) {
+		c->fd_dir = open(s->dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		if (0 > c->fd_dir)
+			goto reset;
 	}
 
-	if (0 > energy_now || 0 > energy_max)
+	if (0 > (s->uevent ? getbattery_uevent : getbattery_files)(c, s, &v))
+		goto reset;
+
+	if (!v.present) {
+		on_battery = false;
+		return fmt_str(buf, buflen, "no battery");
+	}
+	on_battery = v.status_len >= 11 && !memcmp(v.status, "Discharging", 11);
+	if (0 > v.energy_now || 0 >= v.energy_max || 0 > v.power_now)
 		goto error;
 
+	for (status_index=0; s->status_match_count > status_index; ++status_index) {
+		const char *m = s->status_match[status_index];
+		if (v.status_len == strlen(m) && !memcmp(v.status, m, v.status_len))
+			break;
+	}
+	if (status_index == s->status_match_count)
+		status_index = -1;
+	widget_value(0, v.energy_now);
+	widget_value(1, v.energy_max);
+	widget_value(2, v.power_now);
+	widget_value(3, status_index);
+
 	{
-		float battery_pct,
-		      drainage_watt;
 		const char *status_txt;
+		ssize_t rc;
+		size_t cur = 0;
 
-		battery_pct = ((float)energy_now / (float)energy_max) * 100.0;
-		drainage_watt = (float)power_now / 1e6f;
 		status_txt = status_index < 0
 			? s->status_undef
 			: s->status_output[status_index];
 
-		int psize = snprintf(buf, buflen, "%s %.1f %.1f",
-				status_txt, battery_pct, drainage_watt);
-		if (psize >= buflen)
+		/* status, percent of design capacity, watts */
+		if (0 > (rc = fmt_str(buf, buflen, status_txt)))
+			goto error;
+		cur += rc;
+		if (buflen - cur < 2)
 			goto error;
-		return (ssize_t)psize;
+		buf[cur++] = ' ';
+		if (0 > (rc = fmt_fixed(buf + cur, buflen - cur,
+		                        (int64_t)v.energy_now * 100, v.energy_max, 1)))
+			goto error;
+		cur += rc;
+		if (buflen - cur < 2)
+			goto error;
+		buf[cur++] = ' ';
+		if (0 > (rc = fmt_fixed(buf + cur, buflen - cur,
+		                        v.power_now, 1000000, 1)))
+			goto error;
+		cur += rc;
+		return (ssize_t)cur;
 	}
+reset:
+	getbattery_reset(c);
 error:
 	return -1;
 }
@@ -190,15 +1278,17 @@ ssize_t getdiskusage(char *restrict buf, size_t buflen, void *ctx, const Arg arg
 {
 	struct getdiskusage_arg *s = (struct getdiskusage_arg *)arg.v;
 	(void)ctx;
-	const char unit[] = {'B','K','M','G','T'};
-	uint8_t u=0;
+	uint64_t size;
 	size_t cur=0;
 	if (!s->path) goto error;
 
 	if (s->name) {
-		int rc=snprintf((buf+cur), (buflen-cur), "%s: ", s->name);
-		if ((size_t)rc >= buflen-cur) goto error;
+		ssize_t rc=fmt_str(buf, buflen, s->name);
+		if (0 > rc || (size_t)rc + 2 >= buflen) goto error;
 		cur += (size_t)rc;
+		buf[cur++] = ':';
+		buf[cur++] = ' ';
+		buf[cur] = '\0';
 	}
 
 	switch (s->mode) {
@@ -210,16 +1300,7 @@ ssize_t getdiskusage(char *restrict buf, size_t buflen, void *ctx, const Arg arg
 			if (0 > rv)
 				goto norm;
 		}
-		float fsz=(float)st.st_size;
-		for(u=0; fsz>=1000 && u<COUNT(unit)-1; ++u, fsz/=1024);
-		;
-		{
-			int rc=snprintf((buf+cur), (buflen-cur),
-					u>0?"%.1f%c":"%.0f",
-					fsz, unit[u]);
-			if ((size_t)rc >= buflen-cur) goto error;
-			cur += (size_t)rc;
-		}
+		size = (uint64_t)st.st_size;
 		break;
 	case 1:
 		;
@@ -230,18 +1311,17 @@ ssize_t getdiskusage(char *restrict buf, size_t buflen, void *ctx, const Arg arg
 				goto norm;
 		}
 		/* show disk space available for unprivileged users (like `df -h`)*/
-		float fssz_av=(float)stfs.f_frsize * (float)stfs.f_bavail;
-
-		for(u=0; fssz_av>=1000 && u<COUNT(unit)-1; ++u, fssz_av/=1024);
-		;
-		{
-			int rc=snprintf((buf+cur), (buflen-cur),
-					u>0?"%.1f%c":"%.0f",
-					fssz_av, unit[u]);
-			if ((size_t)rc >= buflen-cur) goto error;
-			cur += (size_t)rc;
-		}
+		size = (uint64_t)stfs.f_frsize * stfs.f_bavail;
 		break;
+	default:
+		goto norm;
+	}
+
+	widget_value(0, (int64_t)size);
+	{
+		ssize_t rc=fmt_size((buf+cur), (buflen-cur), size, 1);
+		if (0 > rc) goto error;
+		cur += (size_t)rc;
 	}
 
 norm:
@@ -251,123 +1331,216 @@ error:
 	return -1;
 }
 
+/* Quarter-octave bucket of `rate` */
+static int getnetwork_bucket(uint64_t rate)
+{
+	if (0 == rate)
+		return 0;
+	int e = 63 - __builtin_clzll(rate);
+	int m = 2 <= e ? (rate >> (e - 2)) & 3 : (rate << (2 - e)) & 3;
+	int b = 1 + 4 * e + m;
+
+	return GETNETWORK_BUCKETS > b ? b : GETNETWORK_BUCKETS - 1;
+}
+
+/* Middle of bucket `b` */
+static uint64_t getnetwork_bucket_rate(int b)
+{
+	if (0 == b)
+		return 0;
+	int e = (b - 1) / 4, m = (b - 1) % 4;
+
+	return ((uint64_t)(8 + 2 * m + 1) << e) >> 3;
+}
+
+/* `pct` percentile of the history in direction `d` */
+static uint64_t getnetwork_pct(const struct getnetwork_ctx *c, int d, int pct)
+{
+	unsigned rank = (c->n * pct + 99) / 100,
+		 cum = 0;
+
+	for(int b=0; GETNETWORK_BUCKETS>b; ++b)
+		if (rank <= (cum += c->bucket[d][b]))
+			return getnetwork_bucket_rate(b);
+	return 0;
+}
+
+/* Take a sample of link counters, O(1). Counters going back (link was
+ * re-created) and the first run only set the base.
+ * @return false - no sample taken */
+static bool getnetwork_sample(struct getnetwork_ctx *c, const struct src_rtnl_link *l,
+                              int64_t now, long ewma_ms)
+{
+	const uint64_t cnt[2] = {l->rx, l->tx};
+	int64_t dt = now - c->last_t;
+
+	if (c->last_t && GETNETWORK_MIN_NS > dt)
+		return false;
+	if (!c->last_t || cnt[0] < c->last[0] || cnt[1] < c->last[1]) {
+		c->last[0] = cnt[0];
+		c->last[1] = cnt[1];
+		c->last_t = now;
+		return false;
+	}
+
+	struct getnetwork_sample *smp = &c->hist[c->head];
+	int64_t dt_ms = dt / 1000000;
+	for(int d=0; 2>d; ++d) {
+		if (GETNETWORK_HIST == c->n)
+			--c->bucket[d][getnetwork_bucket(widget_rate(smp->delta[d], smp->dt))];
+		smp->delta[d] = cnt[d] - c->last[d];
+		c->last[d] = cnt[d];
+
+		uint64_t rate = widget_rate(smp->delta[d], dt);
+		++c->bucket[d][getnetwork_bucket(rate)];
+		/* weight of the sample dt/(ewma + dt) approximates 1 - e^(-dt/ewma) */
+		if (0 == c->n || 8 * ewma_ms < dt_ms)
+			c->ewma[d] = rate;
+		else if (rate > c->ewma[d])
+			c->ewma[d] += (rate - c->ewma[d]) * dt_ms / (ewma_ms + dt_ms);
+		else
+			c->ewma[d] -= (c->ewma[d] - rate) * dt_ms / (ewma_ms + dt_ms);
+	}
+	smp->t = now;
+	smp->dt = dt;
+	c->last_t = now;
+	c->head = (c->head + 1) % GETNETWORK_HIST;
+	if (GETNETWORK_HIST > c->n)
+		++c->n;
+	return true;
+}
+
+/* " <rate>", ".." -- idle */
+static ssize_t getnetwork_fmt_rate(char *buf, size_t buflen, uint64_t rate)
+{
+	ssize_t rc;
+
+	if (2 > buflen)
+		return -1;
+	buf[0] = ' ';
+	rc = 0 < rate ? fmt_size(buf + 1, buflen - 1, rate, 1)
+	              : fmt_str(buf + 1, buflen - 1, "..");
+	return 0 > rc ? -1 : rc + 1;
+}
+
 ssize_t getnetwork(char *restrict buf, size_t buflen, void *ctx, const Arg arg)
 {
 	struct getnetwork_arg *s = (struct getnetwork_arg *)arg.v;
 	struct getnetwork_ctx *c = (struct getnetwork_ctx *)ctx;
+	struct src_rtnl_ctx *r = (struct src_rtnl_ctx *)widget_source(0);
+	const struct src_rtnl_link *l;
 	size_t cur=0;
 
-	struct ifaddrs *ial=NULL;
-	struct ifaddrs *ia_packet=NULL,
-		       *ia_inet=NULL;
-
 	/* interface device name */
 	{
-		int rc=snprintf(buf, buflen, "%s:", s->vi_name != NULL ?
+		ssize_t rc=fmt_str(buf, buflen, s->vi_name != NULL ?
 				s->vi_name : s->if_name);
-		if ((size_t)rc >= buflen) goto error;
+		if (0 > rc || (size_t)rc + 1 >= buflen) goto error;
 		cur += (size_t)rc;
+		buf[cur++] = ':';
+		buf[cur] = '\0';
 	}
 
-	if (0 > getifaddrs(&ial))
+	if (!r)
 		goto error;
-
-	struct ifaddrs *ia;
-	for(ia=ial; NULL!=ia; ia=ia->ifa_next) {
-		if (strcmp(s->if_name, ia->ifa_name)) continue;
-		if (NULL == ia->ifa_addr) continue;
-
-		switch(ia->ifa_addr->sa_family) {
-		case AF_PACKET:
-			ia_packet=ia;
-			break;
-		case AF_INET:
-			ia_inet=ia;
-			break;
-		}
+	if (!c->link) {
+		c->link = src_rtnl_link(r, s->if_name);
+		if (!c->link || 0 > src_rtnl_sync(r))
+			goto error;
 	}
+	l = c->link;
 
 	/* not found link device */
-	if (!ia_packet) {
+	if (!l->ifindex) {
 		goto norm;
 	}
+	widget_value(0, l->rx);
+	widget_value(1, l->tx);
+	widget_value(2, l->flags);
 
 	/* interface is down */
-	if (!(IFF_UP & ia_packet->ifa_flags)) {
-		int rc=snprintf((buf+cur), (buflen-cur), " down");
-		if ((size_t)rc >= buflen-cur) goto error;
+	if (!(IFF_UP & l->flags)) {
+		ssize_t rc=fmt_str((buf+cur), (buflen-cur), " down");
+		if (0 > rc) goto error;
 		cur += (size_t)rc;
 		goto norm;
 	}
 
 	/* IP-address */
-	if (!ia_inet || !ia_inet->ifa_addr) {
-		int rc=snprintf((buf+cur), (buflen-cur), " up");
-		if ((size_t)rc >= buflen-cur) goto error;
-		cur += (size_t)rc;
-	} else {
-		struct sockaddr_in *s_in = (struct sockaddr_in *)(ia_inet->ifa_addr);
-		char *ip = inet_ntoa(s_in->sin_addr);
-		int rc=snprintf((buf+cur), (buflen-cur), " %s", ip);
-		if ((size_t)rc >= buflen-cur) goto error;
+	{
+		char ip[1 + INET6_ADDRSTRLEN] = " up";
+		if (l->has_addr)
+			inet_ntop(AF_INET, &l->addr, ip + 1, sizeof(ip) - 1);
+		else if (l->has_addr6)
+			inet_ntop(AF_INET6, &l->addr6, ip + 1, sizeof(ip) - 1);
+		ssize_t rc=fmt_str((buf+cur), (buflen-cur), ip);
+		if (0 > rc) goto error;
 		cur += (size_t)rc;
 	}
 
 	/* rx/tx rates */
-	if (s->view_rates && ia_packet->ifa_data) {
-		struct rtnl_link_stats *stats = ia_packet->ifa_data;
-		uint32_t diff_rx, diff_tx;
-		uint32_t tdiv;
+	if (s->view_rates && l->has_stats) {
+		unsigned char rates = s->rates ? s->rates : GETNETWORK_NOW;
+		ssize_t rc;
 
-		diff_rx = stats->rx_bytes - c->last_rx;
-		diff_tx = stats->tx_bytes - c->last_tx;
-		c->last_rx = stats->rx_bytes;
-		c->last_tx = stats->tx_bytes;
+		getnetwork_sample(c, l, clock_ns(CLOCK_MONOTONIC),
+		                  s->ewma ? s->ewma : GETNETWORK_EWMA_MS);
+		if (0 == c->n)
+			goto norm;
+		const struct getnetwork_sample *last =
+			&c->hist[(c->head + GETNETWORK_HIST - 1) % GETNETWORK_HIST];
 
-		{
-			struct timespec lag, now;
-			clock_gettime(CLOCK_REALTIME, &now);
-			timespec_sub(&lag, &now, &c->last);
-			memcpy(&c->last, &now, sizeof(c->last));
-			if (0 > lag.tv_sec) goto norm;
-			tdiv = (uint32_t)lag.tv_sec + (uint32_t)(lag.tv_nsec/1000000000);
-			if (0.1 >= tdiv) goto norm;
-		}
-
-		uint8_t prx, ptx;
-		uint32_t rx, tx;
-		for(prx=0, rx=diff_rx / tdiv;
-				rx >= 1024;
-				++prx, rx/=1024);
-		for(ptx=0, tx=diff_tx / tdiv;
-				tx >= 1024;
-				++ptx, tx/=1024);
-
-		const char *rxfs, *txfs;
-		rxfs = diff_rx>0 ? " %x%x" : " ..";
-		txfs = diff_tx>0 ? " %x%x" : " ..";
-
-		{
-			int rc=snprintf((buf+cur), (buflen-cur),
-					rxfs, (uint8_t)(rx/64), prx);
-			if ((size_t)rc >= buflen-cur) goto error;
+		for(int d=0; 2>d && GETNETWORK_NOW & rates; ++d) {
+			rc=getnetwork_fmt_rate((buf+cur), (buflen-cur),
+			                       widget_rate(last->delta[d], last->dt));
+			if (0 > rc) goto error;
 			cur += (size_t)rc;
 		}
-		{
-			int rc=snprintf((buf+cur), (buflen-cur),
-					txfs, (uint8_t)(tx/64), ptx);
-			if ((size_t)rc >= buflen-cur) goto error;
+		for(int d=0; 2>d && GETNETWORK_EWMA & rates; ++d) {
+			rc=getnetwork_fmt_rate((buf+cur), (buflen-cur), c->ewma[d]);
+			if (0 > rc) goto error;
+			cur += (size_t)rc;
+		}
+		/* median/95th */
+		for(int d=0; 2>d && GETNETWORK_PCT & rates; ++d) {
+			rc=getnetwork_fmt_rate((buf+cur), (buflen-cur), getnetwork_pct(c, d, 50));
+			if (0 > rc || 2 > buflen-cur-rc) goto error;
 			cur += (size_t)rc;
+			buf[cur++] = '/';
+			rc=getnetwork_fmt_rate((buf+cur), (buflen-cur), getnetwork_pct(c, d, 95));
+			if (0 > rc) goto error;
+			/* no blank after the slash */
+			memmove(buf + cur, buf + cur + 1, rc);
+			cur += (size_t)rc - 1;
+		}
+		if (GETNETWORK_SPARK & rates) {
+			short n = s->spark ? s->spark : 8;
+			uint64_t rate[GETNETWORK_HIST], max = 0;
+			if (n > c->n)
+				n = c->n;
+			/* oldest first, scaled to the busiest */
+			for(short i=0; n>i; ++i) {
+				const struct getnetwork_sample *smp = &c->hist[
+					(c->head + GETNETWORK_HIST - n + i) % GETNETWORK_HIST];
+				rate[i] = widget_rate(smp->delta[0] + smp->delta[1], smp->dt);
+				if (max < rate[i])
+					max = rate[i];
+			}
+			if (2 > buflen-cur) goto error;
+			buf[cur++] = ' ';
+			for(short i=0; n>i; ++i) {
+				int lvl = max ? rate[i] * (COUNT(widget_level) - 1) / max : 0;
+				rc=fmt_str((buf+cur), (buflen-cur), widget_level[lvl]);
+				if (0 > rc) goto error;
+				cur += (size_t)rc;
+			}
 		}
 	}
 
 norm:;
-	freeifaddrs(ial);
 	return (ssize_t)cur;
 
 error:;
-	if (ial)
-		freeifaddrs(ial);
 	buf[0] = '\0';
 	return -1;
 }
@@ -410,28 +1583,606 @@ ssize_t gettemperature(char *restrict buf, const size_t buflen, void *ctx, const
 	}
 	if (c->fd_hwmon < 0)
 		goto error;
+	if (0 >= c->sensor.fd
+	&& 0 > sysattr_open(&c->sensor, c->fd_hwmon, s->sensor,
+	                    c->rbuf, COUNT(c->rbuf)))
+		goto reset;
 
 	/* Read sensor */
-	int psize;
+	ssize_t psize;
 	{
-		char rbuf[21] = {0};
-		int fd_sensor = openat(c->fd_hwmon, s->sensor, O_RDONLY);
-		if (0 > fd_sensor)
+		int64_t millideg;
+
+		if (0 > sysattr_read(&c->sensor))
+			goto reset;
+		if (!parse_int(c->sensor.buf, &millideg))
+			goto error;
+		widget_value(0, millideg);
+		/* at least 2 characters wide, as "%2.0f" was */
+		buf[0] = ' ';
+		psize = fmt_fixed(buf + 1, buflen - 1, millideg, 1000, 0);
+		if (0 > psize)
 			goto error;
+		if (1 < psize)
+			memmove(buf, buf + 1, psize + 1);
+		else
+			++psize;
+	}
+	if (0 > fmt_str(buf + psize, buflen - psize, "°C"))
+		goto error;
+	psize += sizeof("°C") - 1;
+
+	return psize;
+reset:
+	/* hwmon may have been renumbered, look it up again */
+	sysattr_close(&c->sensor);
+	if (0 < c->fd_hwmon)
+		close(c->fd_hwmon);
+	c->fd_hwmon = 0;
+error:;
+	buf[0] = '\0';
+	return -1;
+}
 
-		read(fd_sensor, rbuf, 21);
-		close(fd_sensor);
+/* Account a "cpuN" line of /proc/stat from its first number.
+ * @return end of the line's numbers, NULL - malformed or cut off line */
+static const char *getcpu_line(const char *p, const char *end, struct getcpu_core *core)
+{
+	/* user nice system idle iowait irq softirq steal, guests are in user */
+	uint64_t f[8] = {0}, total = 0, busy;
+	int i;
+
+	/* more lines always follow, no '\n' -- the read buffer was too short */
+	if (!memchr(p, '\n', end - p))
+		return NULL;
+	for(i=0; COUNT(f)>i; ++i) {
+		const char *q = parse_uint(p, end, &f[i]);
+		if (!q)
+			break;
+		p = q;
+		total += f[i];
+	}
+	if (4 > i)
+		return NULL;
+	busy = total - f[3] - f[4];
+
+	if (total > core->total && busy >= core->busy) {
+		uint64_t dt = total - core->total;
+		core->pct = ((busy - core->busy) * 100 + dt / 2) / dt;
+	} else {
+		/* first run, no time passed, or counters were reset */
+		core->pct = 0;
+	}
+	core->busy = busy;
+	core->total = total;
+	core->online = true;
+	return p;
+}
+
+ssize_t getcpu(char *restrict buf, size_t buflen, void *ctx, const Arg arg)
+{
+	struct getcpu_arg *s = (struct getcpu_arg *)arg.v;
+	struct getcpu_ctx *c = (struct getcpu_ctx *)ctx;
+	struct src_readfile_ctx *f = (struct src_readfile_ctx *)widget_source(0);
+	size_t cur=0;
+	ssize_t rc;
+
+	if (!f || 4 > f->len || memcmp(f->buf, "cpu ", 4))
+		goto error;
+	const char *p = f->buf + 4,
+		   *end = f->buf + f->len;
+
+	if (!(p = getcpu_line(p, end, &c->all)))
+		goto error;
+	widget_value(0, c->all.pct);
+	/* per-core lines, only up to the last wanted one */
+	if (0 != s->mode) {
+		for(short i=0; s->ncpu>i; ++i)
+			c->core[i].online = false;
+		while ((p = memchr(p, '\n', end - p)) && 3 < end - ++p
+		&& !memcmp(p, "cpu", 3)) {
+			uint64_t n;
+			if (!(p = parse_uint(p + 3, end, &n)))
+				goto error;
+			if (s->first > (int64_t)n)
+				continue;
+			if (s->first + s->ncpu <= (int64_t)n)
+				break;
+			if (!(p = getcpu_line(p, end, &c->core[n - s->first])))
+				goto error;
+		}
+	}
+
+	if (s->name) {
+		rc=fmt_str(buf, buflen, s->name);
+		if (0 > rc || (size_t)rc + 2 >= buflen) goto error;
+		cur += (size_t)rc;
+		buf[cur++] = ':';
+		buf[cur++] = ' ';
+		buf[cur] = '\0';
+	}
+
+	switch (s->mode) {
+	case 0:
+		rc=fmt_int((buf+cur), (buflen-cur), c->all.pct);
+		if (0 > rc || (size_t)rc + 1 >= buflen-cur) goto error;
+		cur += (size_t)rc;
+		buf[cur++] = '%';
+		buf[cur] = '\0';
+		break;
+	case 1:
+		/* "core:percent", busiest first */
+		for(short k=0, last=-1; s->top>k; ++k) {
+			short best = -1;
+			for(short i=0; s->ncpu>i; ++i) {
+				const struct getcpu_core *core = &c->core[i];
+				if (!core->online)
+					continue;
+				/* below the previous pick, or equal and after it */
+				if (0 <= last
+				&& (core->pct > c->core[last].pct
+				 || (core->pct == c->core[last].pct && i <= last)))
+					continue;
+				if (0 > best || core->pct > c->core[best].pct)
+					best = i;
+			}
+			if (0 > best)
+				break;
+			last = best;
+			if (0 < k) {
+				if (2 > buflen-cur) goto error;
+				buf[cur++] = ' ';
+			}
+			rc=fmt_int((buf+cur), (buflen-cur), s->first + best);
+			if (0 > rc || (size_t)rc + 1 >= buflen-cur) goto error;
+			cur += (size_t)rc;
+			buf[cur++] = ':';
+			rc=fmt_int((buf+cur), (buflen-cur), c->core[best].pct);
+			if (0 > rc) goto error;
+			cur += (size_t)rc;
+		}
+		break;
+	case 2:
+		/* a level of eight per core, blank -- offline */
+		for(short i=0; s->ncpu>i; ++i) {
+			const struct getcpu_core *core = &c->core[i];
+			rc=fmt_str((buf+cur), (buflen-cur), !core->online ? " "
+			           : widget_level[core->pct * (COUNT(widget_level) - 1) / 100]);
+			if (0 > rc) goto error;
+			cur += (size_t)rc;
+		}
+		break;
+	default:
+		goto error;
+	}
+
+	return (ssize_t)cur;
+
+error:;
+	buf[0] = '\0';
+	return -1;
+}
+
+/* Find values of `n` `keys` in /proc/meminfo text, in bytes, stopping once
+ * all of them are found.
+ * @return 0 - success
+ * @return -1 - some key is missing */
+static int getmemory_parse(const char *p, const char *end,
+                           const char *const *keys, int n, uint64_t *val)
+{
+	int left = n;
+	uint64_t found = 0;
 
-		if (rbuf[20] != '\0')
+	while (0 < left && end > p) {
+		const char *colon = memchr(p, ':', end - p);
+		if (!colon)
+			break;
+		size_t len = colon - p;
+		for(int i=0; n>i; ++i) {
+			if (found & (1ull << i) || strncmp(keys[i], p, len)
+			|| '\0' != keys[i][len])
+				continue;
+			if (!parse_uint(colon + 1, end, &val[i]))
+				return -1;
+			/* kB are KiB */
+			val[i] *= 1024;
+			found |= 1ull << i;
+			--left;
+			break;
+		}
+		if (!(p = memchr(colon, '\n', end - colon)))
+			break;
+		++p;
+	}
+	return 0 < left ? -1 : 0;
+}
+
+ssize_t getmemory(char *restrict buf, size_t buflen, void *ctx, const Arg arg)
+{
+	struct getmemory_arg *s = (struct getmemory_arg *)arg.v;
+	struct src_readfile_ctx *f = (struct src_readfile_ctx *)widget_source(0);
+	(void)ctx;
+	static const char *const key_avail[] = {"MemAvailable"},
+			  *const key_used[] = {"MemTotal", "MemAvailable"};
+	const char *const *keys;
+	uint64_t val[GETMEMORY_KEYS];
+	int n = 0;
+	size_t cur=0;
+	ssize_t rc;
+
+	switch (s->mode) {
+	case 0: keys = key_avail; n = COUNT(key_avail); break;
+	case 1: keys = key_used; n = COUNT(key_used); break;
+	case 2:
+		keys = s->keys;
+		if (!keys)
 			goto error;
-		psize = snprintf(buf, buflen,
-		                 "%2.0f°C",
-		                 atof(rbuf) / 1e3f);
+		while (GETMEMORY_KEYS > n && keys[n])
+			++n;
+		break;
+	default:
+		goto error;
 	}
-	if (psize >= buflen)
+
+	if (!f || 0 > getmemory_parse(f->buf, f->buf + f->len, keys, n, val))
 		goto error;
 
-	return psize;
+	if (s->name) {
+		rc=fmt_str(buf, buflen, s->name);
+		if (0 > rc || (size_t)rc + 2 >= buflen) goto error;
+		cur += (size_t)rc;
+		buf[cur++] = ':';
+		buf[cur++] = ' ';
+		buf[cur] = '\0';
+	}
+
+	/* used/total */
+	if (1 == s->mode) {
+		val[1] = val[0] - (val[1] < val[0] ? val[1] : val[0]);
+		uint64_t tmp = val[0];
+		val[0] = val[1];
+		val[1] = tmp;
+	}
+	for(int i=0; n>i; ++i)
+		widget_value(i, (int64_t)val[i]);
+	for(int i=0; n>i; ++i) {
+		if (0 < i) {
+			if (2 > buflen-cur) goto error;
+			buf[cur++] = 1 == s->mode ? '/' : ' ';
+		}
+		if (2 == s->mode && s->labels) {
+			rc=fmt_str((buf+cur), (buflen-cur), s->labels[i]);
+			if (0 > rc) goto error;
+			cur += (size_t)rc;
+		}
+		rc=fmt_size((buf+cur), (buflen-cur), val[i], 1);
+		if (0 > rc) goto error;
+		cur += (size_t)rc;
+	}
+	return (ssize_t)cur;
+
+error:;
+	buf[0] = '\0';
+	return -1;
+}
+
+ssize_t getsegment(char *restrict buf, size_t buflen, void *ctx, const Arg arg)
+{
+	struct getsegment_arg *s = (struct getsegment_arg *)arg.v;
+	struct src_segments_ctx *c = (struct src_segments_ctx *)widget_source(0);
+	(void)ctx;
+	size_t len = 0;
+
+	buf[0] = '\0';
+	if (!c)
+		return -1;
+	for(short i=0; SEGMENTS_MAX>i; ++i)
+		if (!strcmp(c->seg[i].name, s->name)) {
+			len = strnlen(c->seg[i].text, buflen - 1);
+			memcpy(buf, c->seg[i].text, len);
+			buf[len] = '\0';
+			break;
+		}
+	return (ssize_t)len;
+}
+
+/* PSI trigger fired. It can't fire again within its window, so the widget
+ * isn't run more often than that. */
+static int getpressure_event(int fd, uint32_t events, void *data)
+{
+	struct getpressure_res *r = (struct getpressure_res *)data;
+
+	/* trigger is gone with its cgroup */
+	if (EPOLLERR & events) {
+		unwatch_fd(fd);
+		close(fd);
+		r->fd_trig = -1;
+	}
+	return 1;
+}
+
+/* Register `trigger` on the pressure file, see Documentation/accounting/psi.rst */
+static void getpressure_trigger(struct getpressure_res *r, int fd_dir,
+                                const char *name, const char *trigger)
+{
+	r->fd_trig = openat(fd_dir, name, O_RDWR|O_NONBLOCK|O_CLOEXEC);
+	if (0 > r->fd_trig)
+		goto error;
+	/* with its NUL */
+	if (0 > write(r->fd_trig, trigger, strlen(trigger) + 1)
+	|| 0 > watch_fd(r->fd_trig, EPOLLPRI, getpressure_event, r)) {
+		close(r->fd_trig);
+		goto error;
+	}
+	return;
+
+error:
+	ERROR("Can't set PSI trigger \"%s\" on %s. %s", trigger, name, strerror(errno));
+	r->fd_trig = -1;
+}
+
+/* avg10 of the `kind` line in hundredths of percent.
+ * @return NULL - not found */
+static const char *getpressure_avg10(const char *p, const char *end,
+                                     const char *kind, int64_t *v)
+{
+	uint64_t whole, frac = 0;
+
+	for(; end - p > 11; ++p) {
+		if (!memcmp(p, kind, 4) && !memcmp(p + 4, " avg10=", 7))
+			break;
+		if (!(p = memchr(p, '\n', end - p)))
+			return NULL;
+	}
+	if (end - p <= 11 || !(p = parse_uint(p + 11, end, &whole)))
+		return NULL;
+	/* "%lu.%02lu" */
+	if (end - p > 2 && '.' == p[0] && !parse_uint(p + 1, p + 3, &frac))
+		return NULL;
+	*v = whole * 100 + frac;
+	return p;
+}
+
+ssize_t getpressure(char *restrict buf, size_t buflen, void *ctx, const Arg arg)
+{
+	struct getpressure_arg *s = (struct getpressure_arg *)arg.v;
+	struct getpressure_ctx *c = (struct getpressure_ctx *)ctx;
+	static const char *const proc_name[] = {"cpu", "memory", "io"},
+	                  *const cgroup_name[] = {"cpu.pressure", "memory.pressure", "io.pressure"};
+	const char *const *name = s->cgroup ? cgroup_name : proc_name;
+	unsigned char res = s->res ? s->res : GETPRESSURE_CPU|GETPRESSURE_MEMORY|GETPRESSURE_IO;
+	size_t cur = 0;
+	ssize_t rc;
+
+	if (0 == c->fd_dir) {
+		c->fd_dir = open(s->cgroup ? s->cgroup : "/proc/pressure",
+		                 O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		if (0 > c->fd_dir) {
+			ERROR("Can't open %s. %s", s->cgroup ? s->cgroup : "/proc/pressure",
+			      strerror(errno));
+			goto error;
+		}
+	}
+	if (0 > c->fd_dir)
+		goto error;
+
+	if (s->name) {
+		rc=fmt_str(buf, buflen, s->name);
+		if (0 > rc || (size_t)rc + 2 >= buflen) goto error;
+		cur += (size_t)rc;
+		buf[cur++] = ':';
+		buf[cur++] = ' ';
+		buf[cur] = '\0';
+	}
+
+	/* "c1.5 m0.0 i12.3" */
+	for(int i=0; COUNT(c->res)>i; ++i) {
+		struct getpressure_res *r = &c->res[i];
+		int64_t avg;
+		ssize_t n;
+
+		if (!(res & 1u << i))
+			continue;
+		if (s->trigger && 0 == r->fd_trig)
+			getpressure_trigger(r, c->fd_dir, name[i], s->trigger);
+		if (0 >= r->attr.fd
+		&& 0 > sysattr_open(&r->attr, c->fd_dir, name[i], r->rbuf, COUNT(r->rbuf)))
+			goto error;
+		if (0 > (n = sysattr_read(&r->attr))
+		|| !getpressure_avg10(r->attr.buf, r->attr.buf + n, s->full ? "full" : "some", &avg))
+			goto error;
+		widget_value(i, avg);
+
+		if (3 > buflen-cur) goto error;
+		if (0 < cur && ' ' != buf[cur - 1])
+			buf[cur++] = ' ';
+		buf[cur++] = name[i][0];
+		rc=fmt_fixed((buf+cur), (buflen-cur), avg, 100, 1);
+		if (0 > rc) goto error;
+		cur += (size_t)rc;
+	}
+	return (ssize_t)cur;
+
+error:;
+	buf[0] = '\0';
+	return -1;
+}
+
+/* Past the blank-separated field at `p`.
+ * @return NULL - end of the line */
+static const char *getdiskio_skip(const char *p, const char *end)
+{
+	while (end > p && ' ' == *p)
+		++p;
+	while (end > p && ' ' != *p && '\n' != *p)
+		++p;
+	return end > p && '\n' != *p ? p : NULL;
+}
+
+/* Add counters of the line at `p` if it is of `dev`, "major minor name
+ * 11+ numbers".
+ * @return 1 - added
+ * @return 0 - other device
+ * @return -1 - malformed or cut off */
+static int getdiskio_line(const char *p, const char *end, const char *dev,
+                          struct getdiskio_stat *st)
+{
+	uint64_t v[11];
+	size_t len = strlen(dev);
+
+	if (!(p = getdiskio_skip(p, end)) || !(p = getdiskio_skip(p, end)))
+		return -1;
+	++p;
+	if ((size_t)(end - p) <= len || memcmp(p, dev, len) || ' ' != p[len])
+		return 0;
+	p += len;
+	for(int i=0; COUNT(v)>i; ++i)
+		if (!(p = parse_uint(p, end, &v[i])))
+			return -1;
+	/* no '\n' -- cut off by the read buffer, the last number may be too */
+	if (!memchr(p, '\n', end - p))
+		return -1;
+	st->ios[0] += v[0];
+	st->sectors[0] += v[2];
+	st->ios[1] += v[4];
+	st->sectors[1] += v[6];
+	st->ticks += v[3] + v[7];
+	st->queue += v[10];
+	return 1;
+}
+
+/* Sum counters of `devices`, trying lines where they were the last time
+ * first, as the list only changes with hotplug.
+ * @return 0 - success
+ * @return -1 - some device is missing */
+static int getdiskio_read(struct getdiskio_ctx *c, const char *const *devices,
+                          const char *buf, size_t len, struct getdiskio_stat *st)
+{
+	const char *end = buf + len;
+	int n = 0, found = 0;
+
+	for(; n<GETDISKIO_DEVICES && devices[n]; ++n) {
+		size_t off = c->off[n];
+		if (len > off && (0 == off || '\n' == buf[off - 1])
+		&& 1 == getdiskio_line(buf + off, end, devices[n], st))
+			found |= 1 << n;
+	}
+	/* full scan for the rest */
+	for(const char *p = buf; found != (1 << n) - 1 && end > p; ) {
+		for(int i=0; n>i; ++i) {
+			if (found & 1 << i)
+				continue;
+			int rc = getdiskio_line(p, end, devices[i], st);
+			if (0 > rc)
+				return -1;
+			if (0 < rc) {
+				found |= 1 << i;
+				c->off[i] = p - buf;
+				break;
+			}
+		}
+		if (!(p = memchr(p, '\n', end - p)))
+			break;
+		++p;
+	}
+	return found == (1 << n) - 1 ? 0 : -1;
+}
+
+/* Take a sample, at most every 100 ms. Counters going back (device was
+ * re-added) only set the base. */
+static void getdiskio_sample(struct getdiskio_ctx *c, const struct getdiskio_stat *st,
+                             int64_t now)
+{
+	int64_t dt = now - c->last_t;
+	const struct getdiskio_stat *l = &c->last;
+
+	if (c->last_t && 100000000 > dt)
+		return;
+	if (c->last_t
+	&& st->ios[0] >= l->ios[0] && st->ios[1] >= l->ios[1]
+	&& st->sectors[0] >= l->sectors[0] && st->sectors[1] >= l->sectors[1]
+	&& st->ticks >= l->ticks && st->queue >= l->queue) {
+		uint64_t ios = st->ios[0] - l->ios[0] + st->ios[1] - l->ios[1];
+		for(int d=0; 2>d; ++d) {
+			c->bytes[d] = widget_rate((st->sectors[d] - l->sectors[d]) * 512, dt);
+			c->iops[d] = widget_rate(st->ios[d] - l->ios[d], dt);
+		}
+		c->await_us = ios ? (st->ticks - l->ticks) * 1000 / ios : 0;
+		c->queue = (st->queue - l->queue) * 100000 / (dt / 1000);
+	}
+	c->last = *st;
+	c->last_t = now;
+}
+
+ssize_t getdiskio(char *restrict buf, size_t buflen, void *ctx, const Arg arg)
+{
+	struct getdiskio_arg *s = (struct getdiskio_arg *)arg.v;
+	struct getdiskio_ctx *c = (struct getdiskio_ctx *)ctx;
+	struct src_readfile_ctx *f = (struct src_readfile_ctx *)widget_source(0);
+	unsigned char show = s->show ? s->show : GETDISKIO_BYTES;
+	struct getdiskio_stat st = {0};
+	size_t cur = 0;
+	ssize_t rc;
+
+	if (!f || !s->devices
+	|| 0 > getdiskio_read(c, s->devices, f->buf, f->len, &st))
+		goto error;
+	getdiskio_sample(c, &st, clock_ns(CLOCK_MONOTONIC));
+	widget_value(0, c->bytes[0]);
+	widget_value(1, c->bytes[1]);
+	widget_value(2, c->iops[0] + c->iops[1]);
+	widget_value(3, c->await_us);
+
+	if (s->name) {
+		rc=fmt_str(buf, buflen, s->name);
+		if (0 > rc || (size_t)rc + 2 >= buflen) goto error;
+		cur += (size_t)rc;
+		buf[cur++] = ':';
+		buf[cur++] = ' ';
+		buf[cur] = '\0';
+	}
+
+	/* "1.2M/300K 40/12 0.8ms q1.5" */
+	if (GETDISKIO_BYTES & show)
+		for(int d=0; 2>d; ++d) {
+			if (3 > buflen-cur) goto error;
+			if (0 < d)
+				buf[cur++] = '/';
+			rc=fmt_size((buf+cur), (buflen-cur), c->bytes[d], 1);
+			if (0 > rc) goto error;
+			cur += (size_t)rc;
+		}
+	if (GETDISKIO_IOPS & show)
+		for(int d=0; 2>d; ++d) {
+			if (3 > buflen-cur) goto error;
+			if (0 < cur && ' ' != buf[cur - 1])
+				buf[cur++] = 0 < d ? '/' : ' ';
+			rc=fmt_int((buf+cur), (buflen-cur), c->iops[d]);
+			if (0 > rc) goto error;
+			cur += (size_t)rc;
+		}
+	if (GETDISKIO_AWAIT & show) {
+		if (3 > buflen-cur) goto error;
+		if (0 < cur && ' ' != buf[cur - 1])
+			buf[cur++] = ' ';
+		rc=fmt_fixed((buf+cur), (buflen-cur), c->await_us, 1000, 1);
+		if (0 > rc) goto error;
+		cur += (size_t)rc;
+		rc=fmt_str((buf+cur), (buflen-cur), "ms");
+		if (0 > rc) goto error;
+		cur += (size_t)rc;
+	}
+	if (GETDISKIO_QUEUE & show) {
+		if (3 > buflen-cur) goto error;
+		if (0 < cur && ' ' != buf[cur - 1])
+			buf[cur++] = ' ';
+		buf[cur++] = 'q';
+		rc=fmt_fixed((buf+cur), (buflen-cur), c->queue, 100, 1);
+		if (0 > rc) goto error;
+		cur += (size_t)rc;
+	}
+	return (ssize_t)cur;
+
 error:;
 	buf[0] = '\0';
 	return -1;